@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "AutoGain.h"
+#include "BandScaler.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace
+{
+
+// Quantile steps in octaves per second for the slow and the fast mode. The
+// level falls at (1 - kPercentile) of that, e.g. 3 dB/s when slow.
+const float kSlowStep = 5.0f;
+const float kFastStep = 20.0f;
+
+// Time constants of the gain in seconds
+const double kAttackTime = 0.1;
+const double kSlowRelease = 2.0;
+const double kFastRelease = 0.5;
+
+// Gain limits in octaves, -18 to +30 dB
+const float kMinGain = -3.0f;
+const float kMaxGain = 5.0f;
+
+// Frames with no band above this, about -96 dB, count as silence
+const float kSilence = 1.0f / 65536.0f;
+
+} // namespace
+
+void CAutoGain::Configure(Mode mode, double framesPerSecond)
+{
+  if (mode != m_mode)
+    Reset();
+  m_mode = mode;
+
+  const double fps = std::max(framesPerSecond, 1.0);
+  m_step = static_cast<float>((mode == kFast ? kFastStep : kSlowStep) / fps);
+  m_attack = static_cast<float>(1.0 - exp(-1.0 / (kAttackTime * fps)));
+  m_release = static_cast<float>(1.0 - exp(-1.0 / ((mode == kFast ? kFastRelease : kSlowRelease) * fps)));
+}
+
+void CAutoGain::Reset()
+{
+  m_level = kTargetLevel;
+  m_gain = 0.0f;
+}
+
+float CAutoGain::Process(const float* bands, size_t count)
+{
+  if (m_mode == kOff || !count)
+    return 1.0f;
+
+  if (*std::max_element(bands, bands + count) >= kSilence)
+  {
+    // The frame moves the level by at most one step whatever the band count
+    const float up = m_step * kPercentile / count;
+    const float down = m_step * (1.0f - kPercentile) / count;
+    float level = m_level;
+    for (size_t i = 0; i < count; i++)
+      level += CBandScaler::Log2(bands[i]) > m_level ? up : -down;
+    m_level = level;
+
+    const float target = std::min(std::max(kTargetLevel - m_level, kMinGain), kMaxGain);
+    m_gain += (target - m_gain) * (target < m_gain ? m_attack : m_release);
+  }
+
+  return exp2f(m_gain);
+}
+
+float CAutoGain::GainDecibels() const
+{
+  return m_mode == kOff ? 0.0f : m_gain * 6.0206f;
+}
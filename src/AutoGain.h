@@ -0,0 +1,59 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+// Streaming automatic gain control on the analysed band magnitudes, so
+// quiet recordings fill the display and loud masters keep their headroom.
+//
+// A high percentile of the band levels is tracked with a stochastic
+// quantile estimate: per band and frame it moves up by kPercentile of a
+// step if the band is above it and down by the rest otherwise, which
+// settles where that fraction of the bands stays below. No sorting and no
+// history, one compare and add per band. The gain then brings the tracked
+// level to kTargetLevel, following quickly when the music gets louder and
+// slowly when it gets quieter. Silent frames leave everything unchanged.
+class CAutoGain
+{
+public:
+  enum Mode
+  {
+    kOff = 0,
+    kSlow,
+    kFast,
+  };
+
+  // Fraction of the band levels below the tracked level
+  static constexpr float kPercentile = 0.9f;
+  // Tracked level after the gain, in octaves below full scale
+  static constexpr float kTargetLevel = -1.0f;
+
+  // Changing the mode starts over at unity gain
+  void Configure(Mode mode, double framesPerSecond);
+  void Reset();
+
+  // Track the bands of one frame, all channels, and return the gain to
+  // apply to them
+  float Process(const float* bands, size_t count);
+
+  // Current gain in dB
+  float GainDecibels() const;
+
+private:
+  Mode m_mode = kOff;
+
+  // Quantile step and smoothing coefficients per frame
+  float m_step = 0.0f;
+  float m_attack = 1.0f;
+  float m_release = 1.0f;
+
+  // Tracked level and gain as log2 of the magnitude
+  float m_level = kTargetLevel;
+  float m_gain = 0.0f;
+};
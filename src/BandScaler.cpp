@@ -0,0 +1,138 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BandScaler.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace
+{
+
+// Mantissa bits looked up, the rest interpolates between the entries
+const int kTableBits = 8;
+const int kTableSize = 1 << kTableBits;
+
+// Decibels per log2 unit, 20 * log10(2)
+const float kDecibelsPerOctave = 6.0205999f;
+
+// Magnitudes are scaled to the former 16 bit sample peak reduced by 7 bits
+const float kPeak = 255.0f;
+
+// log2(1 + i / kTableSize), one extra entry for the interpolation
+struct Log2Table
+{
+  Log2Table()
+  {
+    for (int i = 0; i <= kTableSize; i++)
+      values[i] = static_cast<float>(log2(1.0 + double(i) / kTableSize));
+  }
+
+  std::array<float, kTableSize + 1> values;
+};
+
+const Log2Table kLog2Table;
+
+// IEC 61672 A-weighting in dB, 0 at 1 kHz
+float AWeighting(float frequency)
+{
+  const double f2 = double(frequency) * frequency;
+  const double ra = 12194.0 * 12194.0 * f2 * f2 /
+                    ((f2 + 20.6 * 20.6) * sqrt((f2 + 107.7 * 107.7) * (f2 + 737.9 * 737.9)) * (f2 + 12194.0 * 12194.0));
+  return static_cast<float>(20.0 * log10(std::max(ra, 1e-12)) + 2.0);
+}
+
+} // namespace
+
+void CBandScaler::Reserve(CArena& arena, int bands)
+{
+  ReserveBuffer(m_weights, arena, bands);
+}
+
+size_t CBandScaler::MemoryUsage() const
+{
+  return BufferBytes(m_weights);
+}
+
+void CBandScaler::Configure(Curve curve, float height, int bands)
+{
+  m_curve = curve;
+  m_weights.assign(bands, 0.0f);
+
+  switch (curve)
+  {
+    case kLinear:
+      m_slope = height;
+      m_offset = 0.0f;
+      m_max = std::numeric_limits<float>::max();
+      break;
+
+    case kDecibel:
+    case kAWeighted:
+    {
+      const float range = kDecibelCeiling - kDecibelFloor;
+      m_slope = height * kDecibelsPerOctave / range;
+      m_offset = -kDecibelFloor * height / range;
+      m_max = height;
+      break;
+    }
+
+    case kLogarithmic:
+    default:
+      // ln(kPeak * x) * height / ln(256), unbounded above
+      m_curve = kLogarithmic;
+      m_slope = height / 8.0f;
+      m_offset = m_slope * log2f(kPeak);
+      m_max = std::numeric_limits<float>::max();
+      break;
+  }
+}
+
+void CBandScaler::SetBandFrequency(int band, float frequency)
+{
+  if (m_curve == kAWeighted && band < int(m_weights.size()))
+    m_weights[band] = AWeighting(frequency) / kDecibelsPerOctave;
+}
+
+void CBandScaler::Apply(const float* magnitudes, float* heights, float gain) const
+{
+  const size_t bands = m_weights.size();
+  if (m_curve == kLinear)
+  {
+    const float slope = m_slope * gain;
+    for (size_t i = 0; i < bands; i++)
+      heights[i] = std::min(magnitudes[i] * slope, m_max);
+    return;
+  }
+
+  // The gain only shifts the log curves
+  const float offset = m_offset + m_slope * Log2(gain);
+  for (size_t i = 0; i < bands; i++)
+  {
+    const float height = m_slope * (Log2(magnitudes[i]) + m_weights[i]) + offset;
+    heights[i] = std::min(std::max(height, 0.0f), m_max);
+  }
+}
+
+float CBandScaler::Log2(float x)
+{
+  // x = 2^exponent * (1 + mantissa), the exponent comes for free and
+  // log2(1 + mantissa) from the table. Zero ends up at -127, which every
+  // curve clamps to 0.
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  const int exponent = int((bits >> 23) & 0xff) - 127;
+  const uint32_t mantissa = bits & 0x7fffff;
+  const uint32_t index = mantissa >> (23 - kTableBits);
+  const float fraction = float(mantissa & ((1u << (23 - kTableBits)) - 1)) * (1.0f / (1u << (23 - kTableBits)));
+  const float* table = kLog2Table.values.data();
+  return float(exponent) + table[index] + fraction * (table[index + 1] - table[index]);
+}
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include "Memory.h"
+
+#include <cstddef>
+
+// Maps the analysed band magnitudes of one channel to bar heights along a
+// selectable curve. All curves but the linear one are affine in log2 of the
+// magnitude, which is read from a small table over the float mantissa with
+// linear interpolation (error below 1e-5), so a band costs a table lookup
+// instead of a logf().
+class CBandScaler
+{
+public:
+  enum Curve
+  {
+    // Natural log of the magnitude in the former 16 bit peak range, the
+    // original look
+    kLogarithmic = 0,
+    kLinear,
+    // Level between kDecibelFloor and kDecibelCeiling dB
+    kDecibel,
+    // Decibels with the A-weighting of the band's center frequency
+    kAWeighted,
+  };
+
+  static constexpr float kDecibelFloor = -60.0f;
+  static constexpr float kDecibelCeiling = 0.0f;
+
+  // Carve the per band storage for up to bands bands from arena
+  void Reserve(CArena& arena, int bands);
+  size_t MemoryUsage() const;
+
+  // height is the height of a full scale band. Resets all band weights,
+  // SetBandFrequency() has to be called again afterwards.
+  void Configure(Curve curve, float height, int bands);
+  void SetBandFrequency(int band, float frequency);
+
+  // Scale the magnitudes of all bands, multiplied by gain, into heights
+  void Apply(const float* magnitudes, float* heights, float gain = 1.0f) const;
+
+  // log2(x) for x > 0 through the mantissa table
+  static float Log2(float x);
+
+private:
+  Curve m_curve = kLogarithmic;
+  float m_slope = 1.0f;
+  float m_offset = 0.0f;
+  float m_max = 0.0f;
+  // Per band weights in log2 units
+  ArenaVector<float> m_weights;
+};
@@ -0,0 +1,175 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BarAnimation.h"
+
+#ifdef HAS_GL
+
+bool CBarAnimation::Init(const std::string& vertShader, const std::string& fragShader)
+{
+  if (!LoadShaderFiles(vertShader, fragShader) || !CompileAndLink())
+    return false;
+
+  // The captured output only takes effect with the next link
+  const GLchar* varyings[] = { "v_current" };
+  glTransformFeedbackVaryings(ProgramHandle(), 1, varyings, GL_INTERLEAVED_ATTRIBS);
+  glLinkProgram(ProgramHandle());
+  GLint linked = GL_FALSE;
+  glGetProgramiv(ProgramHandle(), GL_LINK_STATUS, &linked);
+  if (linked != GL_TRUE)
+    return false;
+
+  m_uSpeed = glGetUniformLocation(ProgramHandle(), "u_speed");
+  m_hTarget = glGetAttribLocation(ProgramHandle(), "a_target");
+  m_hCurrent = glGetAttribLocation(ProgramHandle(), "a_current");
+
+  glGenBuffers(1, &m_targetVBO);
+  glGenBuffers(2, m_currentVBO);
+  glGenTextures(2, m_textures);
+  m_bars = 0;
+  m_ready = true;
+  return true;
+}
+
+void CBarAnimation::Deinit()
+{
+  if (!m_ready)
+    return;
+
+  glDeleteTextures(2, m_textures);
+  glDeleteBuffers(2, m_currentVBO);
+  glDeleteBuffers(1, &m_targetVBO);
+  m_textures[0] = m_textures[1] = 0;
+  m_currentVBO[0] = m_currentVBO[1] = 0;
+  m_targetVBO = 0;
+  m_bars = 0;
+  m_ready = false;
+}
+
+void CBarAnimation::Reset(const float* current, size_t bars)
+{
+  m_bars = bars;
+  m_current = 0;
+
+  const GLsizeiptr size = bars * sizeof(GLfloat);
+  glBindBuffer(GL_ARRAY_BUFFER, m_targetVBO);
+  glBufferData(GL_ARRAY_BUFFER, size, current, GL_DYNAMIC_DRAW);
+  for (int i = 0; i < 2; i++)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, m_currentVBO[i]);
+    glBufferData(GL_ARRAY_BUFFER, size, current, GL_DYNAMIC_COPY);
+    glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, m_currentVBO[i]);
+  }
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void CBarAnimation::SetTargets(const float* targets)
+{
+  glBindBuffer(GL_ARRAY_BUFFER, m_targetVBO);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, m_bars * sizeof(GLfloat), targets);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void CBarAnimation::Step(float speed)
+{
+  if (!m_bars)
+    return;
+
+  m_speed = speed;
+  const int next = 1 - m_current;
+
+  EnableShader();
+
+  glBindBuffer(GL_ARRAY_BUFFER, m_targetVBO);
+  glVertexAttribPointer(m_hTarget, 1, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glEnableVertexAttribArray(m_hTarget);
+  glBindBuffer(GL_ARRAY_BUFFER, m_currentVBO[m_current]);
+  glVertexAttribPointer(m_hCurrent, 1, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glEnableVertexAttribArray(m_hCurrent);
+
+  // One point per bar, nothing is drawn
+  glEnable(GL_RASTERIZER_DISCARD);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_currentVBO[next]);
+  glBeginTransformFeedback(GL_POINTS);
+  glDrawArrays(GL_POINTS, 0, GLsizei(m_bars));
+  glEndTransformFeedback();
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+  glDisable(GL_RASTERIZER_DISCARD);
+
+  glDisableVertexAttribArray(m_hTarget);
+  glDisableVertexAttribArray(m_hCurrent);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  DisableShader();
+
+  m_current = next;
+}
+
+const float* CBarAnimation::MapHeights()
+{
+  if (!m_bars)
+    return nullptr;
+
+  glBindBuffer(GL_ARRAY_BUFFER, m_currentVBO[m_current]);
+  const void* heights = glMapBufferRange(GL_ARRAY_BUFFER, 0, m_bars * sizeof(GLfloat), GL_MAP_READ_BIT);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return static_cast<const float*>(heights);
+}
+
+void CBarAnimation::UnmapHeights()
+{
+  glBindBuffer(GL_ARRAY_BUFFER, m_currentVBO[m_current]);
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool CBarAnimation::OnEnabled()
+{
+  glUniform1f(m_uSpeed, m_speed);
+  return true;
+}
+
+#else
+
+bool CBarAnimation::Init(const std::string&, const std::string&)
+{
+  return false;
+}
+
+void CBarAnimation::Deinit()
+{
+}
+
+void CBarAnimation::Reset(const float*, size_t)
+{
+}
+
+void CBarAnimation::SetTargets(const float*)
+{
+}
+
+void CBarAnimation::Step(float)
+{
+}
+
+const float* CBarAnimation::MapHeights()
+{
+  return nullptr;
+}
+
+void CBarAnimation::UnmapHeights()
+{
+}
+
+bool CBarAnimation::OnEnabled()
+{
+  return true;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <kodi/gui/gl/GL.h>
+#include <kodi/gui/gl/Shader.h>
+
+#include <cstddef>
+#include <string>
+
+// Bar animation on the GPU, the same step towards the target heights as
+// CBarHeights::Animate(). Target heights are uploaded only when a new row
+// was presented; every frame a transform feedback pass moves the current
+// heights from one buffer into the other. The bar shader reads the result
+// per bar from a texture buffer, so frames without a new row need neither
+// CPU work on the heights nor an upload.
+//
+// Needs transform feedback and texture buffers, so it is only available
+// with desktop OpenGL. Init() fails elsewhere and the CPU path stays in use.
+class CBarAnimation : public kodi::gui::gl::CShaderProgram
+{
+public:
+  bool Init(const std::string& vertShader, const std::string& fragShader);
+  void Deinit();
+  bool IsReady() const { return m_ready; }
+
+  // Size the buffers for bars bars and start from the given heights
+  void Reset(const float* current, size_t bars);
+  size_t Bars() const { return m_bars; }
+
+  // Targets and both current height buffers in GPU memory
+  size_t GpuBytes() const { return 3 * m_bars * sizeof(GLfloat); }
+
+  void SetTargets(const float* targets);
+
+  // Move every current height towards its target by at most speed
+  void Step(float speed);
+
+  // Texture buffer with the current heights after the last Step()
+  GLuint Heights() const { return m_textures[m_current]; }
+
+  // The current heights mapped for reading, waiting for the GPU, to hand
+  // the animation back to the CPU. Null if mapping failed. UnmapHeights()
+  // before the next Step().
+  const float* MapHeights();
+  void UnmapHeights();
+
+  bool OnEnabled() override;
+
+private:
+  bool m_ready = false;
+  size_t m_bars = 0;
+  float m_speed = 0.0f;
+
+  GLuint m_targetVBO = 0;
+  GLuint m_currentVBO[2] = {0};
+  GLuint m_textures[2] = {0};
+  int m_current = 0;
+
+  GLint m_uSpeed = -1;
+  GLint m_hTarget = -1;
+  GLint m_hCurrent = -1;
+};
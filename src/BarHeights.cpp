@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BarHeights.h"
+
+#include <algorithm>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BAR_HEIGHTS_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BAR_HEIGHTS_NEON
+#endif
+
+void CBarHeights::Resize(int rows, int cols)
+{
+  m_rows = rows;
+  m_cols = cols;
+  m_count = size_t(rows) * cols;
+
+  // Padding at the end stays zero in both arrays, so the vector loop never
+  // needs a scalar tail
+  const size_t blocks = (m_count + 3) / 4;
+  m_targetStorage.assign(blocks, Block());
+  m_currentStorage.assign(blocks, Block());
+  m_target = blocks ? m_targetStorage[0].v : nullptr;
+  m_current = blocks ? m_currentStorage[0].v : nullptr;
+
+  Clear();
+}
+
+void CBarHeights::Reserve(CArena& arena, int rows, int maxCols)
+{
+  const size_t blocks = (size_t(rows) * maxCols + 3) / 4;
+  ReserveBuffer(m_targetStorage, arena, blocks);
+  ReserveBuffer(m_currentStorage, arena, blocks);
+  m_target = nullptr;
+  m_current = nullptr;
+  m_rows = 0;
+  m_cols = 0;
+  m_count = 0;
+}
+
+size_t CBarHeights::MemoryUsage() const
+{
+  return BufferBytes(m_targetStorage) + BufferBytes(m_currentStorage);
+}
+
+void CBarHeights::Clear()
+{
+  const size_t size = m_targetStorage.size() * sizeof(Block);
+  if (size)
+  {
+    memset(m_target, 0, size);
+    memset(m_current, 0, size);
+  }
+}
+
+float* CBarHeights::PushRow()
+{
+  if (m_rows > 1)
+    memmove(m_target + m_cols, m_target, (m_rows - 1) * m_cols * sizeof(float));
+  return m_target;
+}
+
+void CBarHeights::Animate(float speed)
+{
+  // Branch free form of "step towards the target, but not further than
+  // speed": c += clamp(t - c, -speed, speed)
+  const size_t count = m_targetStorage.size() * 4;
+  const float* __restrict target = m_target;
+  float* __restrict current = m_current;
+
+#if defined(BAR_HEIGHTS_SSE)
+  const __m128 hi = _mm_set1_ps(speed);
+  const __m128 lo = _mm_set1_ps(-speed);
+  for (size_t i = 0; i < count; i += 4)
+  {
+    const __m128 c = _mm_load_ps(current + i);
+    const __m128 d = _mm_sub_ps(_mm_load_ps(target + i), c);
+    _mm_store_ps(current + i, _mm_add_ps(c, _mm_min_ps(_mm_max_ps(d, lo), hi)));
+  }
+#elif defined(BAR_HEIGHTS_NEON)
+  const float32x4_t hi = vdupq_n_f32(speed);
+  const float32x4_t lo = vdupq_n_f32(-speed);
+  for (size_t i = 0; i < count; i += 4)
+  {
+    const float32x4_t c = vld1q_f32(current + i);
+    const float32x4_t d = vsubq_f32(vld1q_f32(target + i), c);
+    vst1q_f32(current + i, vaddq_f32(c, vminq_f32(vmaxq_f32(d, lo), hi)));
+  }
+#else
+  for (size_t i = 0; i < count; i++)
+    current[i] += std::min(std::max(target[i] - current[i], -speed), speed);
+#endif
+}
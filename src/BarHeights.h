@@ -0,0 +1,57 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include "Memory.h"
+
+#include <cstddef>
+
+// Target and currently displayed heights of all bars of the grid, stored as
+// contiguous row-major arrays. Row 0 is the newest spectrum, older rows move
+// towards the back of the grid with every new row.
+class CBarHeights
+{
+public:
+  void Resize(int rows, int cols);
+  void Clear();
+
+  // Carve the storage from arena for grids of up to rows x maxCols. Resize()
+  // has to be called again afterwards.
+  void Reserve(CArena& arena, int rows, int maxCols);
+  size_t MemoryUsage() const;
+
+  // Shift all rows back by one and return the now free row 0 of the targets
+  float* PushRow();
+
+  // Move every displayed height towards its target by at most speed
+  void Animate(float speed);
+
+  int Rows() const { return m_rows; }
+  int Cols() const { return m_cols; }
+  size_t Count() const { return m_count; }
+
+  float* Target() { return m_target; }
+  const float* Target() const { return m_target; }
+  float* Current() { return m_current; }
+  const float* Current() const { return m_current; }
+
+private:
+  // 16 byte aligned blocks so the animation can use full vector loads
+  struct alignas(16) Block
+  {
+    float v[4];
+  };
+
+  ArenaVector<Block> m_targetStorage;
+  ArenaVector<Block> m_currentStorage;
+  float* m_target = nullptr;
+  float* m_current = nullptr;
+  int m_rows = 0;
+  int m_cols = 0;
+  size_t m_count = 0;
+};
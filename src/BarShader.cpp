@@ -0,0 +1,87 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BarShader.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+bool CBarShader::Create(const std::string& vertShader, const std::string& fragShader, int features)
+{
+  // #version has to come first, so the sources leave it to us
+#if defined(HAS_GL)
+  std::string header = "#version 150\n";
+#else
+  std::string header = "#version 100\n";
+#endif
+  if (features & kPoints)
+    header += "#define POINTS\n";
+  if (features & kGpuHeights)
+    header += "#define GPU_HEIGHTS\n";
+
+  return LoadShaderFiles(vertShader, fragShader) && CompileAndLink(header, "", header, "");
+}
+
+void CBarShader::OnCompiledAndLinked()
+{
+  // Uniforms and attributes a variant does not use are -1
+  m_uProjMatrix = glGetUniformLocation(ProgramHandle(), "u_projectionMatrix");
+  m_uModelMatrix = glGetUniformLocation(ProgramHandle(), "u_modelViewMatrix");
+  m_uPointSize = glGetUniformLocation(ProgramHandle(), "u_pointSize");
+  m_uIntensity = glGetUniformLocation(ProgramHandle(), "u_intensity");
+  m_uGrid = glGetUniformLocation(ProgramHandle(), "u_grid");
+  m_uHeights = glGetUniformLocation(ProgramHandle(), "u_heights");
+  m_hGrid = glGetAttribLocation(ProgramHandle(), "a_grid");
+  m_hCol = glGetAttribLocation(ProgramHandle(), "a_color");
+  m_hHeight = glGetAttribLocation(ProgramHandle(), "a_height");
+}
+
+bool CBarShader::OnEnabled()
+{
+  // This is called after glUseProgram()
+  glUniformMatrix4fv(m_uProjMatrix, 1, GL_FALSE, glm::value_ptr(m_uniforms.projection));
+  glUniformMatrix4fv(m_uModelMatrix, 1, GL_FALSE, glm::value_ptr(m_uniforms.modelView));
+  glUniform1f(m_uIntensity, m_uniforms.intensity);
+  glUniform4fv(m_uGrid, 1, m_uniforms.grid);
+  if (m_uPointSize >= 0)
+    glUniform1f(m_uPointSize, m_uniforms.pointSize);
+  if (m_uHeights >= 0)
+    glUniform1i(m_uHeights, 0);
+
+  return true;
+}
+
+void CBarShaders::Init(const std::string& vertShader, const std::string& fragShader)
+{
+  Deinit();
+  m_vertShader = vertShader;
+  m_fragShader = fragShader;
+}
+
+void CBarShaders::Deinit()
+{
+  for (std::unique_ptr<CBarShader>& variant : m_variants)
+    variant.reset();
+  m_failed.fill(false);
+}
+
+CBarShader* CBarShaders::Get(int features)
+{
+  if (features < 0 || features >= CBarShader::kVariants || m_failed[features])
+    return nullptr;
+
+  std::unique_ptr<CBarShader>& variant = m_variants[features];
+  if (!variant)
+  {
+    variant.reset(new CBarShader);
+    if (!variant->Create(m_vertShader, m_fragShader, features))
+    {
+      variant.reset();
+      m_failed[features] = true;
+    }
+  }
+  return variant.get();
+}
@@ -0,0 +1,90 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <kodi/gui/gl/GL.h>
+#include <kodi/gui/gl/Shader.h>
+
+#include <array>
+#include <memory>
+#include <string>
+
+#include <glm/glm.hpp>
+
+// Uniform values of the bar shader, the same for every variant
+struct BarUniforms
+{
+  glm::mat4 projection{1.0f};
+  glm::mat4 modelView{1.0f};
+  GLfloat pointSize = 0.0f;
+  GLfloat intensity = 1.0f;
+  // Bar spacing, bar width, last row and columns
+  GLfloat grid[4] = {0.0f};
+};
+
+// One variant of the bar shader. The features are compiled in as defines
+// in front of the shader sources, so e.g. solid bars carry neither the
+// point size nor the round point discard.
+class CBarShader : public kodi::gui::gl::CShaderProgram
+{
+public:
+  enum Feature
+  {
+    // Round points of u_pointSize pixels
+    kPoints = 1,
+    // Heights fetched per bar from the texture buffer of CBarAnimation
+    // instead of the per vertex attribute, desktop OpenGL only
+    kGpuHeights = 2,
+  };
+  static constexpr int kVariants = 4;
+
+  bool Create(const std::string& vertShader, const std::string& fragShader, int features);
+
+  // Taken over by the next EnableShader()
+  void SetUniforms(const BarUniforms& uniforms) { m_uniforms = uniforms; }
+
+  GLint GridAttribute() const { return m_hGrid; }
+  GLint ColorAttribute() const { return m_hCol; }
+  // -1 with kGpuHeights
+  GLint HeightAttribute() const { return m_hHeight; }
+
+  void OnCompiledAndLinked() override;
+  bool OnEnabled() override;
+
+private:
+  BarUniforms m_uniforms;
+
+  GLint m_uProjMatrix = -1;
+  GLint m_uModelMatrix = -1;
+  GLint m_uPointSize = -1;
+  GLint m_uIntensity = -1;
+  GLint m_uGrid = -1;
+  GLint m_uHeights = -1;
+  GLint m_hGrid = -1;
+  GLint m_hCol = -1;
+  GLint m_hHeight = -1;
+};
+
+// All variants of the bar shader, each compiled the first time it is asked
+// for and kept until Deinit()
+class CBarShaders
+{
+public:
+  void Init(const std::string& vertShader, const std::string& fragShader);
+  void Deinit();
+
+  // The variant with the given features, nullptr if it does not compile.
+  // A failed variant is not tried again.
+  CBarShader* Get(int features);
+
+private:
+  std::string m_vertShader;
+  std::string m_fragShader;
+  std::array<std::unique_ptr<CBarShader>, CBarShader::kVariants> m_variants;
+  std::array<bool, CBarShader::kVariants> m_failed{};
+};
@@ -0,0 +1,183 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BeatDetector.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace
+{
+
+// Tempo octave the inter-onset intervals are folded into, one bin per BPM
+const int kMinTempo = 80;
+const int kMaxTempo = 160;
+
+// Onsets remembered for the inter-onset intervals and the longest interval
+// taken into account
+const size_t kOnsetHistory = 8;
+const double kMaxInterval = 2.0;
+
+// Time constant of the adaptive threshold in seconds, how many standard
+// deviations above the mean flux an onset needs and the shortest time
+// between two onsets
+const double kThresholdTime = 1.0;
+const float kThresholdDeviations = 1.5f;
+const double kMinOnsetInterval = 0.1;
+
+// Histogram decay per onset
+const float kHistogramDecay = 0.95f;
+
+// Fraction of the beat period an onset may be off the prediction to still
+// count as the beat, and the number of periods without onsets after which
+// the prediction stops
+const double kBeatWindow = 0.25;
+const double kMaxSilentBeats = 4.0;
+
+} // namespace
+
+void CBeatDetector::Reset(double frameRate)
+{
+  m_previous.clear();
+  m_fluxMean = 0.0f;
+  m_fluxVar = 0.0f;
+  m_fluxAlpha = static_cast<float>(1.0 - exp(-1.0 / (std::max(frameRate, 1.0) * kThresholdTime)));
+  m_flux[0] = m_flux[1] = 0.0f;
+  m_frameTime = 0.0;
+
+  m_onset = false;
+  m_lastOnset = -1.0;
+  m_onsetTimes.assign(kOnsetHistory, -1.0);
+  m_onsetPos = 0;
+  m_histogram.assign(kMaxTempo - kMinTempo, 0.0f);
+  m_tempo = 0.0;
+
+  m_lastBeat = -1.0;
+  m_nextBeat = -1.0;
+}
+
+void CBeatDetector::Reserve(CArena& arena, size_t maxBands)
+{
+  ReserveBuffer(m_previous, arena, maxBands);
+  ReserveBuffer(m_onsetTimes, arena, kOnsetHistory);
+  ReserveBuffer(m_histogram, arena, kMaxTempo - kMinTempo);
+}
+
+size_t CBeatDetector::MemoryUsage() const
+{
+  return BufferBytes(m_previous) + BufferBytes(m_onsetTimes) + BufferBytes(m_histogram);
+}
+
+bool CBeatDetector::Process(const float* bands, size_t count, double timestamp)
+{
+  if (m_previous.size() != count)
+    m_previous.assign(count, 0.0f);
+
+  // Spectral flux: only rising bands count, on a log scale so quiet bands
+  // contribute as well
+  float flux = 0.0f;
+  for (size_t i = 0; i < count; i++)
+  {
+    const float value = logf(1.0f + bands[i]);
+    flux += std::max(value - m_previous[i], 0.0f);
+    m_previous[i] = value;
+  }
+
+  // The previous frame is an onset if its flux is a local peak well above
+  // the recent average
+  const float threshold = m_fluxMean + kThresholdDeviations * sqrtf(m_fluxVar);
+  const double onsetTime = m_frameTime;
+  m_onset = m_flux[0] > m_flux[1] && m_flux[0] >= flux && m_flux[0] > threshold &&
+            (m_lastOnset < 0.0 || onsetTime - m_lastOnset >= kMinOnsetInterval);
+
+  const float delta = flux - m_fluxMean;
+  m_fluxMean += m_fluxAlpha * delta;
+  m_fluxVar = (1.0f - m_fluxAlpha) * (m_fluxVar + m_fluxAlpha * delta * delta);
+  m_flux[1] = m_flux[0];
+  m_flux[0] = flux;
+  m_frameTime = timestamp;
+
+  if (m_onset)
+  {
+    UpdateTempo(onsetTime);
+    m_lastOnset = onsetTime;
+  }
+
+  if (m_tempo <= 0.0)
+    return m_onset;
+
+  const double period = 60.0 / m_tempo;
+  if (m_lastOnset >= 0.0 && timestamp - m_lastOnset > kMaxSilentBeats * period)
+  {
+    // Nothing to follow anymore
+    m_nextBeat = -1.0;
+    return false;
+  }
+
+  if (m_onset)
+  {
+    if (m_nextBeat < 0.0 || fabs(onsetTime - m_nextBeat) < kBeatWindow * period ||
+        onsetTime - m_lastBeat > (1.0 - kBeatWindow) * period)
+    {
+      m_lastBeat = onsetTime;
+      m_nextBeat = onsetTime + period;
+      return true;
+    }
+
+    // Onset right after a predicted beat, pull the phase towards it
+    if (onsetTime - m_lastBeat < kBeatWindow * period)
+      m_nextBeat = onsetTime + period;
+    return false;
+  }
+
+  // No onset where one was expected, keep the beat going
+  if (m_nextBeat >= 0.0 && timestamp >= m_nextBeat)
+  {
+    m_lastBeat = timestamp;
+    m_nextBeat += period;
+    return true;
+  }
+
+  return false;
+}
+
+void CBeatDetector::UpdateTempo(double onsetTime)
+{
+  for (float& bin : m_histogram)
+    bin *= kHistogramDecay;
+
+  for (double previous : m_onsetTimes)
+  {
+    const double interval = onsetTime - previous;
+    if (previous < 0.0 || interval <= 0.0 || interval > kMaxInterval)
+      continue;
+
+    // Fold into the tempo range, so half and double tempo support each
+    // other
+    double tempo = 60.0 / interval;
+    while (tempo < kMinTempo)
+      tempo *= 2.0;
+    while (tempo >= kMaxTempo)
+      tempo *= 0.5;
+
+    // Spread over the neighbouring bins, nearer onsets weigh more
+    const int bin = static_cast<int>(tempo) - kMinTempo;
+    const float weight = static_cast<float>(1.0 - interval / kMaxInterval);
+    m_histogram[bin] += weight;
+    if (bin > 0)
+      m_histogram[bin - 1] += weight * 0.5f;
+    if (bin + 1 < static_cast<int>(m_histogram.size()))
+      m_histogram[bin + 1] += weight * 0.5f;
+  }
+
+  m_onsetTimes[m_onsetPos] = onsetTime;
+  m_onsetPos = (m_onsetPos + 1) % m_onsetTimes.size();
+
+  const auto best = std::max_element(m_histogram.begin(), m_histogram.end());
+  if (*best > 0.0f)
+    m_tempo = kMinTempo + (best - m_histogram.begin()) + 0.5;
+}
@@ -0,0 +1,62 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include "Memory.h"
+
+#include <cstddef>
+
+// Streaming onset detector and tempo tracker working on the band magnitudes
+// of the spectrum analyser, so it needs no FFT of its own.
+//
+// Onsets are peaks of the spectral flux (summed increase of the log band
+// magnitudes) above an adaptive threshold. The tempo is the strongest entry
+// of a decaying histogram of inter-onset intervals folded into 80-160 BPM,
+// and beats are predicted from it, locking onto onsets close to the
+// prediction. Cost is O(bands) per frame plus O(tempo bins) per onset.
+class CBeatDetector
+{
+public:
+  CBeatDetector() { Reset(1.0); }
+
+  // frameRate is the number of analysis frames per second
+  void Reset(double frameRate);
+
+  // Carve the history from arena for up to maxBands bands per frame.
+  // Reset() has to be called again afterwards.
+  void Reserve(CArena& arena, size_t maxBands);
+  size_t MemoryUsage() const;
+
+  // Feeds the band magnitudes of one analysis frame with its stream time in
+  // seconds, returns true if a beat falls on this frame
+  bool Process(const float* bands, size_t count, double timestamp);
+
+  bool Onset() const { return m_onset; }
+  // Tempo in beats per minute, 0 while not known yet
+  double Tempo() const { return m_tempo; }
+
+private:
+  void UpdateTempo(double onsetTime);
+
+  ArenaVector<float> m_previous;
+  float m_fluxMean = 0.0f;
+  float m_fluxVar = 0.0f;
+  float m_fluxAlpha = 0.0f;
+  float m_flux[2] = {0.0f, 0.0f};
+  double m_frameTime = 0.0;
+
+  bool m_onset = false;
+  double m_lastOnset = -1.0;
+  ArenaVector<double> m_onsetTimes;
+  size_t m_onsetPos = 0;
+  ArenaVector<float> m_histogram;
+  double m_tempo = 0.0;
+
+  double m_lastBeat = -1.0;
+  double m_nextBeat = -1.0;
+};
@@ -0,0 +1,220 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "Capture.h"
+
+#include <string.h>
+
+namespace
+{
+
+const char kMagic[4] = { 'S', 'P', 'C', 'P' };
+const uint32_t kVersion = 1;
+
+void PutU32(std::vector<uint8_t>& out, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+    out.push_back(uint8_t(value >> (i * 8)));
+}
+
+void PutString(std::vector<uint8_t>& out, const std::string& value)
+{
+  PutU32(out, uint32_t(value.size()));
+  out.insert(out.end(), value.begin(), value.end());
+}
+
+uint32_t GetU32(const uint8_t* in)
+{
+  return uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+}
+
+bool GetString(const std::vector<uint8_t>& in, size_t offset, std::string& value)
+{
+  if (offset + 4 > in.size())
+    return false;
+  const uint32_t length = GetU32(&in[offset]);
+  if (offset + 4 + length > in.size())
+    return false;
+  value.assign(reinterpret_cast<const char*>(&in[offset + 4]), length);
+  return true;
+}
+
+} // namespace
+
+bool CCaptureWriter::Open(const std::string& path)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  CloseFile();
+
+  m_file = fopen(path.c_str(), "wb");
+  if (!m_file)
+    return false;
+
+  std::vector<uint8_t> header(kMagic, kMagic + 4);
+  PutU32(header, kVersion);
+  fwrite(header.data(), 1, header.size(), m_file);
+
+  m_last = std::chrono::steady_clock::now();
+  return true;
+}
+
+void CCaptureWriter::Close()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  CloseFile();
+}
+
+bool CCaptureWriter::IsOpen() const
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return m_file != nullptr;
+}
+
+void CCaptureWriter::CloseFile()
+{
+  if (m_file)
+  {
+    fclose(m_file);
+    m_file = nullptr;
+  }
+}
+
+void CCaptureWriter::WriteStart(int channels, int samplesPerSec, int bitsPerSample, const std::string& songName)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_file)
+    return;
+
+  m_payload.clear();
+  PutU32(m_payload, uint32_t(channels));
+  PutU32(m_payload, uint32_t(samplesPerSec));
+  PutU32(m_payload, uint32_t(bitsPerSample));
+  PutString(m_payload, songName);
+  WriteRecord(CAPTURE_START, m_payload);
+}
+
+void CCaptureWriter::WriteAudio(const float* audioData, size_t audioDataLength)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_file)
+    return;
+
+  m_payload.clear();
+  m_payload.reserve(audioDataLength * sizeof(float));
+  for (size_t i = 0; i < audioDataLength; i++)
+  {
+    uint32_t bits;
+    memcpy(&bits, &audioData[i], sizeof(bits));
+    PutU32(m_payload, bits);
+  }
+  WriteRecord(CAPTURE_AUDIO, m_payload);
+}
+
+void CCaptureWriter::WriteSetting(const std::string& settingName, int value)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_file)
+    return;
+
+  m_payload.clear();
+  PutU32(m_payload, uint32_t(value));
+  PutString(m_payload, settingName);
+  WriteRecord(CAPTURE_SETTING, m_payload);
+}
+
+void CCaptureWriter::WriteRecord(CaptureRecordType type, const std::vector<uint8_t>& payload)
+{
+  const auto now = std::chrono::steady_clock::now();
+  const auto delta = std::chrono::duration_cast<std::chrono::microseconds>(now - m_last).count();
+  m_last = now;
+
+  std::vector<uint8_t> header;
+  header.push_back(type);
+  PutU32(header, uint32_t(delta));
+  PutU32(header, uint32_t(payload.size()));
+
+  fwrite(header.data(), 1, header.size(), m_file);
+  fwrite(payload.data(), 1, payload.size(), m_file);
+}
+
+bool CCaptureReader::Open(const std::string& path)
+{
+  Close();
+
+  m_file = fopen(path.c_str(), "rb");
+  if (!m_file)
+    return false;
+
+  uint8_t header[8];
+  if (fread(header, 1, sizeof(header), m_file) != sizeof(header) ||
+      memcmp(header, kMagic, sizeof(kMagic)) != 0 ||
+      GetU32(&header[4]) != kVersion)
+  {
+    Close();
+    return false;
+  }
+
+  m_timestampUs = 0;
+  return true;
+}
+
+void CCaptureReader::Close()
+{
+  if (m_file)
+  {
+    fclose(m_file);
+    m_file = nullptr;
+  }
+}
+
+bool CCaptureReader::Next(CaptureRecord& record)
+{
+  if (!m_file)
+    return false;
+
+  uint8_t header[9];
+  if (fread(header, 1, sizeof(header), m_file) != sizeof(header))
+    return false;
+
+  const uint32_t size = GetU32(&header[5]);
+  m_payload.resize(size);
+  if (size && fread(m_payload.data(), 1, size, m_file) != size)
+    return false;
+
+  m_timestampUs += GetU32(&header[1]);
+  record.type = CaptureRecordType(header[0]);
+  record.timestampUs = m_timestampUs;
+
+  switch (record.type)
+  {
+    case CAPTURE_START:
+      if (size < 12)
+        return false;
+      record.channels = int(GetU32(&m_payload[0]));
+      record.samplesPerSec = int(GetU32(&m_payload[4]));
+      record.bitsPerSample = int(GetU32(&m_payload[8]));
+      return GetString(m_payload, 12, record.name);
+
+    case CAPTURE_AUDIO:
+      record.samples.resize(size / sizeof(float));
+      for (size_t i = 0; i < record.samples.size(); i++)
+      {
+        const uint32_t bits = GetU32(&m_payload[i * sizeof(float)]);
+        memcpy(&record.samples[i], &bits, sizeof(float));
+      }
+      return true;
+
+    case CAPTURE_SETTING:
+      if (size < 4)
+        return false;
+      record.value = int(GetU32(&m_payload[0]));
+      return GetString(m_payload, 4, record.name);
+
+    default:
+      return false;
+  }
+}
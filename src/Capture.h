@@ -0,0 +1,95 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Binary session capture of everything Kodi hands to the add-on.
+//
+// The file starts with the 4 byte magic "SPCP" and a uint32 format version,
+// followed by records of
+//   uint8  type
+//   uint32 microseconds since the previous record
+//   uint32 payload size in bytes
+//   payload
+// All values are stored little endian.
+//
+// Payloads:
+//   CAPTURE_START    int32 channels, int32 samplesPerSec, int32 bitsPerSample,
+//                    uint32 name length, song name
+//   CAPTURE_AUDIO    float samples, count is derived from the payload size
+//   CAPTURE_SETTING  int32 value, uint32 name length, setting name
+enum CaptureRecordType : uint8_t
+{
+  CAPTURE_START = 1,
+  CAPTURE_AUDIO = 2,
+  CAPTURE_SETTING = 3,
+};
+
+struct CaptureRecord
+{
+  CaptureRecordType type = CAPTURE_START;
+  uint64_t timestampUs = 0;
+
+  int channels = 0;
+  int samplesPerSec = 0;
+  int bitsPerSample = 0;
+  std::string name;
+  int value = 0;
+  std::vector<float> samples;
+};
+
+// Safe to use from several threads: Kodi's audio thread writes the audio
+// while settings arrive on another one, and the file may be closed at any
+// time. Records are written whole and in the order the calls got the lock.
+class CCaptureWriter
+{
+public:
+  ~CCaptureWriter() { Close(); }
+
+  bool Open(const std::string& path);
+  void Close();
+  bool IsOpen() const;
+
+  void WriteStart(int channels, int samplesPerSec, int bitsPerSample, const std::string& songName);
+  void WriteAudio(const float* audioData, size_t audioDataLength);
+  void WriteSetting(const std::string& settingName, int value);
+
+private:
+  // Called with m_mutex held
+  void CloseFile();
+  void WriteRecord(CaptureRecordType type, const std::vector<uint8_t>& payload);
+
+  mutable std::mutex m_mutex;
+  FILE* m_file = nullptr;
+  std::chrono::steady_clock::time_point m_last;
+  std::vector<uint8_t> m_payload;
+};
+
+class CCaptureReader
+{
+public:
+  ~CCaptureReader() { Close(); }
+
+  bool Open(const std::string& path);
+  void Close();
+
+  // Read the next record, returns false at the end of the file or on a
+  // truncated or malformed record
+  bool Next(CaptureRecord& record);
+
+private:
+  FILE* m_file = nullptr;
+  uint64_t m_timestampUs = 0;
+  std::vector<uint8_t> m_payload;
+};
@@ -0,0 +1,53 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+// Bar vertices in the same layout as on OpenGL: packed grid coordinates
+// and color in one stream, the bar height in another. The position is
+// rebuilt here.
+
+struct VS_OUT
+{
+  float4 pos : SV_POSITION;
+  float4 col : COLOR;
+};
+
+cbuffer cbViewProj : register(b0)
+{
+  float4x4 view;
+  float4x4 proj;
+};
+
+cbuffer cbWorld : register(b1)
+{
+  float4x4 world;
+};
+
+cbuffer cbGrid : register(b2)
+{
+  float4 grid; // bar spacing, bar width, last row, columns
+  float4 intensity; // x only
+};
+
+VS_OUT main(float4 gridPos : POSITION, float4 col : COLOR, float height : TEXCOORD0)
+{
+  // Normalized bytes: column, row, corner bits x | y << 1 | z << 2
+  float3 cell = floor(gridPos.xyz * 255.0 + 0.5);
+
+  // corner.y is 0 for the bottom and 1 for the top of a bar
+  float3 corner = fmod(floor(cell.zzz / float3(1.0, 2.0, 4.0)), 2.0);
+  float4 pos = float4(-1.6 + cell.x * grid.x + corner.x * grid.y,
+                      corner.y * height,
+                      -1.6 + (grid.z - cell.y) * grid.x + corner.z * grid.y,
+                      1.0);
+
+  VS_OUT r = (VS_OUT)0;
+  r.pos = mul(  pos, world);
+  r.pos = mul(r.pos, view);
+  r.pos = mul(r.pos, proj);
+  r.col = float4(saturate(col.rgb * intensity.x), col.a);
+  return r;
+}
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "FFT.h"
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+bool CFFT::Init(int size)
+{
+  if (size < 2 || (size & (size - 1)) != 0)
+    return false;
+
+  m_size = size;
+  m_bitReverse.resize(size);
+  m_cos.resize(size / 2);
+  m_sin.resize(size / 2);
+  m_re.resize(size);
+  m_im.resize(size);
+
+  int bits = 0;
+  while ((1 << bits) < size)
+    bits++;
+
+  for (int i = 0; i < size; i++)
+  {
+    int reversed = 0;
+    for (int b = 0; b < bits; b++)
+      reversed |= ((i >> b) & 1) << (bits - 1 - b);
+    m_bitReverse[i] = reversed;
+  }
+
+  for (int i = 0; i < size / 2; i++)
+  {
+    const double angle = -2.0 * M_PI * i / size;
+    m_cos[i] = float(cos(angle));
+    m_sin[i] = float(sin(angle));
+  }
+
+  return true;
+}
+
+void CFFT::Reserve(CArena& arena, int maxSize)
+{
+  ReserveBuffer(m_bitReverse, arena, maxSize);
+  ReserveBuffer(m_cos, arena, maxSize / 2);
+  ReserveBuffer(m_sin, arena, maxSize / 2);
+  ReserveBuffer(m_re, arena, maxSize);
+  ReserveBuffer(m_im, arena, maxSize);
+  m_size = 0;
+}
+
+size_t CFFT::MemoryUsage() const
+{
+  return BufferBytes(m_bitReverse) + BufferBytes(m_cos) + BufferBytes(m_sin) + BufferBytes(m_re) +
+         BufferBytes(m_im);
+}
+
+void CFFT::Magnitudes(const float* input, float* magnitudes)
+{
+  for (int i = 0; i < m_size; i++)
+  {
+    m_re[m_bitReverse[i]] = input[i];
+    m_im[m_bitReverse[i]] = 0.0f;
+  }
+
+  for (int len = 2; len <= m_size; len <<= 1)
+  {
+    const int half = len >> 1;
+    const int step = m_size / len;
+    for (int start = 0; start < m_size; start += len)
+    {
+      for (int k = 0; k < half; k++)
+      {
+        const float wr = m_cos[k * step];
+        const float wi = m_sin[k * step];
+        const int a = start + k;
+        const int b = a + half;
+        const float tr = m_re[b] * wr - m_im[b] * wi;
+        const float ti = m_re[b] * wi + m_im[b] * wr;
+        m_re[b] = m_re[a] - tr;
+        m_im[b] = m_im[a] - ti;
+        m_re[a] += tr;
+        m_im[a] += ti;
+      }
+    }
+  }
+
+  for (int i = 0; i < m_size / 2; i++)
+    magnitudes[i] = sqrtf(m_re[i] * m_re[i] + m_im[i] * m_im[i]);
+}
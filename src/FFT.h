@@ -0,0 +1,34 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include "Memory.h"
+
+// In-place iterative radix-2 FFT for power of two sizes, twiddle factors and
+// the bit reversal permutation are computed once in Init().
+class CFFT
+{
+public:
+  bool Init(int size);
+  int Size() const { return m_size; }
+
+  // Carve the tables from arena for sizes up to maxSize
+  void Reserve(CArena& arena, int maxSize);
+  size_t MemoryUsage() const;
+
+  // Magnitudes of the first size / 2 bins of the real input signal
+  void Magnitudes(const float* input, float* magnitudes);
+
+private:
+  int m_size = 0;
+  ArenaVector<int> m_bitReverse;
+  ArenaVector<float> m_cos;
+  ArenaVector<float> m_sin;
+  ArenaVector<float> m_re;
+  ArenaVector<float> m_im;
+};
@@ -0,0 +1,75 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "FrameWorker.h"
+
+void CFrameWorker::Start(std::function<void()> job)
+{
+  Stop();
+
+  m_job = std::move(job);
+  m_pending = false;
+  m_stop = false;
+  m_thread = std::thread(&CFrameWorker::Process, this);
+}
+
+void CFrameWorker::Stop()
+{
+  if (!m_thread.joinable())
+    return;
+
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_all();
+  m_thread.join();
+}
+
+void CFrameWorker::Kick()
+{
+  if (!m_thread.joinable())
+  {
+    if (m_job)
+      m_job();
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_pending = true;
+  }
+  m_cond.notify_all();
+}
+
+void CFrameWorker::Wait()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cond.wait(lock, [this] { return !m_pending || m_stop; });
+}
+
+void CFrameWorker::Process()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true)
+  {
+    m_cond.wait(lock, [this] { return m_pending || m_stop; });
+    if (m_stop)
+      break;
+
+    lock.unlock();
+    m_job();
+    lock.lock();
+
+    m_pending = false;
+    m_cond.notify_all();
+  }
+
+  // Nobody must be left waiting for a run that never happens
+  m_pending = false;
+  m_cond.notify_all();
+}
@@ -0,0 +1,40 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Runs a job on a background thread, one run per Kick(). Used to prepare the
+// data of the next frame while the current one is submitted to the GPU.
+class CFrameWorker
+{
+public:
+  ~CFrameWorker() { Stop(); }
+
+  void Start(std::function<void()> job);
+  void Stop();
+
+  // Begin one run of the job. Without a running thread the job runs inline.
+  void Kick();
+
+  // Wait until the last kicked run has finished
+  void Wait();
+
+private:
+  void Process();
+
+  std::function<void()> m_job;
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  bool m_pending = false;
+  bool m_stop = false;
+};
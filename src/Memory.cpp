@@ -0,0 +1,89 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "Memory.h"
+
+#include <new>
+
+namespace
+{
+
+size_t AlignUp(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+CArena::~CArena()
+{
+  ::operator delete(m_block, std::align_val_t(kAlignment));
+}
+
+void CArena::BeginMeasure()
+{
+  m_measuring = true;
+  m_measured = 0;
+}
+
+void CArena::Commit()
+{
+  ::operator delete(m_block, std::align_val_t(kAlignment));
+  m_block = m_measured ? static_cast<uint8_t*>(::operator new(m_measured, std::align_val_t(kAlignment))) : nullptr;
+  m_capacity = m_measured;
+  m_used = 0;
+  m_overflow = 0;
+  m_measuring = false;
+}
+
+void* CArena::Allocate(size_t bytes)
+{
+  // Padding every allocation keeps the next one aligned as well
+  bytes = AlignUp(bytes, kAlignment);
+  if (m_measuring)
+  {
+    m_measured += bytes;
+    return ::operator new(bytes, std::align_val_t(kAlignment));
+  }
+
+  if (m_used + bytes > m_capacity)
+  {
+    m_overflow += bytes;
+    return ::operator new(bytes, std::align_val_t(kAlignment));
+  }
+
+  void* p = m_block + m_used;
+  m_used += bytes;
+  return p;
+}
+
+void CArena::Deallocate(void* p)
+{
+  if (!Owns(p))
+    ::operator delete(p, std::align_val_t(kAlignment));
+}
+
+void CMemoryReport::Add(const std::string& subsystem, size_t cpuBytes, size_t gpuBytes)
+{
+  m_entries.push_back({ subsystem, cpuBytes, gpuBytes });
+}
+
+size_t CMemoryReport::CpuBytes() const
+{
+  size_t bytes = 0;
+  for (const Entry& entry : m_entries)
+    bytes += entry.cpuBytes;
+  return bytes;
+}
+
+size_t CMemoryReport::GpuBytes() const
+{
+  size_t bytes = 0;
+  for (const Entry& entry : m_entries)
+    bytes += entry.gpuBytes;
+  return bytes;
+}
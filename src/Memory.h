@@ -0,0 +1,153 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// One block of memory all analysis and render buffers can be carved from,
+// used by the SPECTRUM_STATIC_ALLOCATION build. Its size is found by a
+// measuring pass: buffers are reserved once with the arena measuring, then
+// Commit() allocates the block and the same reservations are made again,
+// this time carved from it. Memory is only returned with the whole block,
+// so the arena has to outlive all buffers carved from it. Should a buffer
+// ever outgrow its reservation, the arena falls back to the heap and counts
+// the bytes in Overflow() instead of failing.
+class CArena
+{
+public:
+  // Alignment of every allocation, enough for the 16 byte blocks of the
+  // bar heights
+  static const size_t kAlignment = 16;
+
+  ~CArena();
+
+  // Start a measuring pass. Allocations come from the heap and are only
+  // counted, buffers still in the previous block must be replaced during the
+  // pass as the block goes away on Commit().
+  void BeginMeasure();
+
+  // Replace the block by one of the measured size
+  void Commit();
+
+  void* Allocate(size_t bytes);
+  void Deallocate(void* p);
+
+  size_t Capacity() const { return m_capacity; }
+  size_t Used() const { return m_used; }
+  // Bytes allocated from the heap since Commit() as the block was full
+  size_t Overflow() const { return m_overflow; }
+
+private:
+  bool Owns(const void* p) const
+  {
+    const uintptr_t address = reinterpret_cast<uintptr_t>(p);
+    const uintptr_t block = reinterpret_cast<uintptr_t>(m_block);
+    return address >= block && address < block + m_capacity;
+  }
+
+  uint8_t* m_block = nullptr;
+  size_t m_capacity = 0;
+  size_t m_used = 0;
+  size_t m_measured = 0;
+  size_t m_overflow = 0;
+  bool m_measuring = false;
+};
+
+// Allocator for standard containers carving from a CArena. Default
+// constructed it uses the heap, so buffers work the same without an arena.
+template<typename T>
+class ArenaAllocator
+{
+public:
+  using value_type = T;
+
+  ArenaAllocator() = default;
+  explicit ArenaAllocator(CArena* arena) : m_arena(arena) {}
+  template<typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.Arena()) {}
+
+  T* allocate(size_t n)
+  {
+    static_assert(alignof(T) <= CArena::kAlignment, "alignment not supported by CArena");
+    if (m_arena)
+      return static_cast<T*>(m_arena->Allocate(n * sizeof(T)));
+    if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t)
+  {
+    if (m_arena)
+      m_arena->Deallocate(p);
+    else if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      ::operator delete(p, std::align_val_t(alignof(T)));
+    else
+      ::operator delete(p);
+  }
+
+  CArena* Arena() const { return m_arena; }
+
+  // Buffers take the arena of the buffer they are assigned from
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+private:
+  CArena* m_arena = nullptr;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.Arena() == b.Arena(); }
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.Arena() != b.Arena(); }
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Replace buffer by an empty one from arena with room for capacity elements,
+// so later resizes up to that size don't allocate
+template<typename T>
+void ReserveBuffer(ArenaVector<T>& buffer, CArena& arena, size_t capacity)
+{
+  buffer = ArenaVector<T>(ArenaAllocator<T>(&arena));
+  buffer.reserve(capacity);
+}
+
+// Bytes held by a buffer, including its unused capacity
+template<typename T, typename A>
+size_t BufferBytes(const std::vector<T, A>& buffer)
+{
+  return buffer.capacity() * sizeof(T);
+}
+
+// Bytes held in CPU memory and GPU buffers, per subsystem
+class CMemoryReport
+{
+public:
+  struct Entry
+  {
+    std::string subsystem;
+    size_t cpuBytes;
+    size_t gpuBytes;
+  };
+
+  void Add(const std::string& subsystem, size_t cpuBytes, size_t gpuBytes = 0);
+
+  const std::vector<Entry>& Entries() const { return m_entries; }
+  size_t CpuBytes() const;
+  size_t GpuBytes() const;
+
+private:
+  std::vector<Entry> m_entries;
+};
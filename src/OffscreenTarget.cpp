@@ -0,0 +1,256 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "OffscreenTarget.h"
+
+#include <algorithm>
+
+// GLES 2 has no separate draw and read framebuffers, no multisampled
+// renderbuffers and only guarantees 16 bit depth
+#if defined(HAS_GL) || HAS_GLES >= 3
+#define OFFSCREEN_MULTISAMPLE
+#endif
+
+namespace
+{
+
+#ifdef OFFSCREEN_MULTISAMPLE
+const GLenum kColorFormat = GL_RGBA8;
+const GLenum kDepthFormat = GL_DEPTH_COMPONENT24;
+const size_t kDepthBytes = 4;
+#else
+const GLenum kColorFormat = GL_RGBA;
+const GLenum kDepthFormat = GL_DEPTH_COMPONENT16;
+const size_t kDepthBytes = 2;
+#endif
+
+} // namespace
+
+bool COffscreenTarget::Init(const std::string& vertShader, const std::string& fragShader)
+{
+  if (!LoadShaderFiles(vertShader, fragShader) || !CompileAndLink())
+    return false;
+
+  const GLfloat quad[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+  glGenBuffers(1, &m_quadVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  return true;
+}
+
+bool COffscreenTarget::Begin(float scale)
+{
+  if (!m_quadVBO)
+    return false;
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const int width = std::max(int(viewport[2] * scale + 0.5f), 1);
+  const int height = std::max(int(viewport[3] * scale + 0.5f), 1);
+
+  // A failed size is not retried until the size changes
+  if (width != m_width || height != m_height)
+  {
+    DeleteBuffers();
+    m_width = width;
+    m_height = height;
+    m_ready = Create(width, height);
+  }
+  if (!m_ready)
+    return false;
+
+  std::copy(viewport, viewport + 4, m_viewport);
+#ifdef OFFSCREEN_MULTISAMPLE
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_drawTarget);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &m_readTarget);
+#else
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &m_drawTarget);
+  m_readTarget = m_drawTarget;
+#endif
+  m_scissor = glIsEnabled(GL_SCISSOR_TEST);
+
+  // The scissor box is meant for the output, not for our own buffers
+  glDisable(GL_SCISSOR_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glViewport(0, 0, m_width, m_height);
+
+  // Transparent where nothing is drawn, so the skin shows through there
+  GLfloat clearColor[4];
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+  return true;
+}
+
+void COffscreenTarget::End()
+{
+#ifdef OFFSCREEN_MULTISAMPLE
+  if (m_samples)
+  {
+    // Multisampled buffers can only be blitted at their own size
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_resolveFramebuffer);
+    glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  }
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_drawTarget);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_readTarget);
+#else
+  glBindFramebuffer(GL_FRAMEBUFFER, m_drawTarget);
+#endif
+  glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+  if (m_scissor)
+    glEnable(GL_SCISSOR_TEST);
+
+  GLint blendSrcRgb, blendDstRgb, blendSrcAlpha, blendDstAlpha, activeTexture, texture;
+  glGetIntegerv(GL_BLEND_SRC_RGB, &blendSrcRgb);
+  glGetIntegerv(GL_BLEND_DST_RGB, &blendDstRgb);
+  glGetIntegerv(GL_BLEND_SRC_ALPHA, &blendSrcAlpha);
+  glGetIntegerv(GL_BLEND_DST_ALPHA, &blendDstAlpha);
+  glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+  const bool blend = glIsEnabled(GL_BLEND);
+  const bool depthTest = glIsEnabled(GL_DEPTH_TEST);
+
+  // Premultiplied colors over what is already there
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  glDisable(GL_DEPTH_TEST);
+  glActiveTexture(GL_TEXTURE0);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+
+  EnableShader();
+  glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+  glVertexAttribPointer(m_hPosition, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glEnableVertexAttribArray(m_hPosition);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glDisableVertexAttribArray(m_hPosition);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  DisableShader();
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glActiveTexture(activeTexture);
+  glBlendFuncSeparate(blendSrcRgb, blendDstRgb, blendSrcAlpha, blendDstAlpha);
+  if (!blend)
+    glDisable(GL_BLEND);
+  if (depthTest)
+    glEnable(GL_DEPTH_TEST);
+}
+
+void COffscreenTarget::Deinit()
+{
+  DeleteBuffers();
+  if (m_quadVBO)
+    glDeleteBuffers(1, &m_quadVBO);
+  m_quadVBO = 0;
+}
+
+void COffscreenTarget::DeleteBuffers()
+{
+  glDeleteFramebuffers(1, &m_framebuffer);
+  glDeleteFramebuffers(1, &m_resolveFramebuffer);
+  glDeleteRenderbuffers(1, &m_colorBuffer);
+  glDeleteRenderbuffers(1, &m_depthBuffer);
+  glDeleteTextures(1, &m_texture);
+  m_framebuffer = 0;
+  m_resolveFramebuffer = 0;
+  m_colorBuffer = 0;
+  m_depthBuffer = 0;
+  m_texture = 0;
+  m_width = 0;
+  m_height = 0;
+  m_samples = 0;
+  m_ready = false;
+}
+
+bool COffscreenTarget::Create(int width, int height)
+{
+#ifdef OFFSCREEN_MULTISAMPLE
+  GLint maxSamples = 0;
+  glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+  m_samples = std::min(int(maxSamples), kMaxSamples);
+  if (m_samples < 2)
+    m_samples = 0;
+#else
+  m_samples = 0;
+#endif
+
+  GLint previousTexture = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+  glGenTextures(1, &m_texture);
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, kColorFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, previousTexture);
+
+  glGenRenderbuffers(1, &m_depthBuffer);
+#ifdef OFFSCREEN_MULTISAMPLE
+  if (m_samples)
+  {
+    glGenRenderbuffers(1, &m_colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_colorBuffer);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, m_samples, kColorFormat, width, height);
+  }
+  glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+  glRenderbufferStorageMultisample(GL_RENDERBUFFER, m_samples, kDepthFormat, width, height);
+#else
+  glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, kDepthFormat, width, height);
+#endif
+
+  GLint previous = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+
+  glGenFramebuffers(1, &m_framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  if (m_samples)
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBuffer);
+  else
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+  bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+  if (complete && m_samples)
+  {
+    glGenFramebuffers(1, &m_resolveFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_resolveFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0);
+    complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  }
+
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, previous);
+  return complete;
+}
+
+size_t COffscreenTarget::GpuBytes() const
+{
+  // RGBA8 texture, depth per sample and the multisampled RGBA8 color
+  const size_t pixels = size_t(m_width) * m_height;
+  return m_ready ? pixels * 4 + pixels * kDepthBytes * std::max(m_samples, 1) +
+                       (m_samples ? pixels * 4 * m_samples : 0)
+                 : 0;
+}
+
+void COffscreenTarget::OnCompiledAndLinked()
+{
+  m_uTexture = glGetUniformLocation(ProgramHandle(), "u_texture");
+  m_hPosition = glGetAttribLocation(ProgramHandle(), "a_position");
+}
+
+bool COffscreenTarget::OnEnabled()
+{
+  glUniform1i(m_uTexture, 0);
+  return true;
+}
+
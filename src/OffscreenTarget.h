@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <kodi/gui/gl/GL.h>
+#include <kodi/gui/gl/Shader.h>
+
+#include <cstddef>
+#include <string>
+
+// Reduced resolution render target. The scene is drawn into a framebuffer
+// scaled down from the current viewport, multisampled where supported, and
+// then drawn over the framebuffer that was bound before as a textured quad
+// with linear filtering. That way the fill cost depends on the scale only
+// and not on the display resolution.
+//
+// The target is cleared to transparent black, so it holds premultiplied
+// alpha and the quad is blended over what Kodi drew behind, like drawing
+// directly would.
+//
+// GLES 2 has no glBlitFramebuffer and draws single sampled into the
+// texture. Begin() fails if the framebuffer cannot be created and the
+// caller draws directly.
+class COffscreenTarget : public kodi::gui::gl::CShaderProgram
+{
+public:
+  // Compiles the shader drawing the quad, Begin() fails without it
+  bool Init(const std::string& vertShader, const std::string& fragShader);
+
+  // Redirect drawing into a target of scale times the current viewport,
+  // cleared to transparent black. Returns false if that is not possible.
+  bool Begin(float scale);
+
+  // Resolve and draw scaled up over the framebuffer and viewport that were
+  // bound when Begin() was called. The blend and depth test state and the
+  // texture binding are left as they were.
+  void End();
+
+  void Deinit();
+
+  // Color and depth buffers in GPU memory, 0 before the first Begin()
+  size_t GpuBytes() const;
+
+  void OnCompiledAndLinked() override;
+  bool OnEnabled() override;
+
+private:
+  bool Create(int width, int height);
+  void DeleteBuffers();
+
+  // Samples per pixel when multisampling is supported
+  static constexpr int kMaxSamples = 4;
+
+  int m_width = 0;
+  int m_height = 0;
+  int m_samples = 0;
+  bool m_ready = false;
+
+  // Color and depth drawn into. Multisampled color is resolved into the
+  // texture before scaling, single sampled color is the texture itself.
+  GLuint m_framebuffer = 0;
+  GLuint m_colorBuffer = 0;
+  GLuint m_depthBuffer = 0;
+  GLuint m_resolveFramebuffer = 0;
+  GLuint m_texture = 0;
+
+  // The quad covering the viewport
+  GLuint m_quadVBO = 0;
+  GLint m_uTexture = -1;
+  GLint m_hPosition = -1;
+
+  // State of the caller restored by End()
+  GLint m_drawTarget = 0;
+  GLint m_readTarget = 0;
+  GLint m_viewport[4] = {0};
+  bool m_scissor = false;
+};
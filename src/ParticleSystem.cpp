@@ -0,0 +1,116 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "ParticleSystem.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#include <glm/gtc/type_ptr.hpp>
+
+bool CParticleSystem::Init(const std::string& vertShader, const std::string& fragShader)
+{
+  if (!LoadShaderFiles(vertShader, fragShader) || !CompileAndLink())
+    return false;
+
+  // Per particle: band, phase within its lifetime, flight direction and the
+  // energy needed to take part. A fixed seed keeps the pattern the same on
+  // every start.
+  std::vector<glm::vec4> seeds(kParticles);
+  uint32_t state = 0x12345678;
+  auto random = [&state] {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) * (1.0f / 16777216.0f);
+  };
+  for (int i = 0; i < kParticles; i++)
+    seeds[i] = glm::vec4(float(i % kBands), random(), random(), random());
+
+  glGenBuffers(1, &m_seedVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, m_seedVBO);
+  glBufferData(GL_ARRAY_BUFFER, seeds.size() * sizeof(glm::vec4), seeds.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  return true;
+}
+
+void CParticleSystem::Deinit()
+{
+  if (m_seedVBO)
+    glDeleteBuffers(1, &m_seedVBO);
+  m_seedVBO = 0;
+}
+
+void CParticleSystem::Energies(const float* heights, size_t cols, float* energies)
+{
+  for (int band = 0; band < kBands; band++)
+  {
+    const size_t first = cols * band / kBands;
+    const size_t last = std::max(cols * (band + 1) / kBands, first + 1);
+
+    float energy = 0.0f;
+    for (size_t col = first; col < last && col < cols; col++)
+      energy = std::max(energy, heights[col]);
+    energies[band] = std::min(energy, 1.0f);
+  }
+}
+
+void CParticleSystem::Draw(const glm::mat4& projection, const glm::mat4& modelView, float time, float pointSize,
+                           const float* energies)
+{
+  if (!m_seedVBO)
+    return;
+
+  m_projection = projection;
+  m_modelView = modelView;
+  m_time = fmodf(time, kLifetime);
+  m_pointSize = pointSize;
+  m_energies = energies;
+
+  EnableShader();
+
+  glBindBuffer(GL_ARRAY_BUFFER, m_seedVBO);
+  glVertexAttribPointer(m_hSeed, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), nullptr);
+  glEnableVertexAttribArray(m_hSeed);
+
+  // Glowing particles add up and do not hide each other. Alpha is left as
+  // it is, so they add to the skin the same when composited from offscreen.
+  glEnable(GL_BLEND);
+  glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE);
+  glDepthMask(GL_FALSE);
+
+  glDrawArrays(GL_POINTS, 0, kParticles);
+
+  glDepthMask(GL_TRUE);
+  glDisable(GL_BLEND);
+  glDisableVertexAttribArray(m_hSeed);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  DisableShader();
+}
+
+void CParticleSystem::OnCompiledAndLinked()
+{
+  m_uProjMatrix = glGetUniformLocation(ProgramHandle(), "u_projectionMatrix");
+  m_uModelMatrix = glGetUniformLocation(ProgramHandle(), "u_modelViewMatrix");
+  m_uPointSize = glGetUniformLocation(ProgramHandle(), "u_pointSize");
+  m_uTime = glGetUniformLocation(ProgramHandle(), "u_time");
+  m_uEnergy = glGetUniformLocation(ProgramHandle(), "u_energy");
+  m_hSeed = glGetAttribLocation(ProgramHandle(), "a_seed");
+}
+
+bool CParticleSystem::OnEnabled()
+{
+  glUniformMatrix4fv(m_uProjMatrix, 1, GL_FALSE, glm::value_ptr(m_projection));
+  glUniformMatrix4fv(m_uModelMatrix, 1, GL_FALSE, glm::value_ptr(m_modelView));
+  glUniform1f(m_uPointSize, m_pointSize);
+  glUniform1f(m_uTime, m_time);
+  glUniform1fv(m_uEnergy, kBands, m_energies);
+
+  return true;
+}
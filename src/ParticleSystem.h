@@ -0,0 +1,66 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <kodi/gui/gl/GL.h>
+#include <kodi/gui/gl/Shader.h>
+
+#include <cstddef>
+#include <string>
+
+#include <glm/glm.hpp>
+
+// Particle fountains fed by the band energies. The particle pool lives in a
+// static vertex buffer created once and is simulated entirely in the vertex
+// shader from the time uniform: every particle restarts its flight once per
+// lifetime and the band energy decides whether it takes part and how fast
+// it flies. Per frame the CPU only hands over the energies and issues one
+// draw call.
+class CParticleSystem : public kodi::gui::gl::CShaderProgram
+{
+public:
+  // Particles in the pool and the band energies the shader takes, must
+  // match PARTICLE_BANDS in the particle shaders
+  static constexpr int kParticles = 32768;
+  static constexpr int kBands = 32;
+
+  // Flight time of a particle in seconds, must match the particle vertex
+  // shader. The time uniform wraps around after it to keep its precision.
+  static constexpr float kLifetime = 1.5f;
+
+  bool Init(const std::string& vertShader, const std::string& fragShader);
+  void Deinit();
+
+  // Size of the particle pool in GPU memory, 0 before Init()
+  size_t GpuBytes() const { return m_seedVBO ? kParticles * sizeof(glm::vec4) : 0; }
+
+  // Resamples the newest row of bar heights to kBands energies in 0..1
+  static void Energies(const float* heights, size_t cols, float* energies);
+
+  void Draw(const glm::mat4& projection, const glm::mat4& modelView, float time, float pointSize,
+            const float* energies);
+
+  void OnCompiledAndLinked() override;
+  bool OnEnabled() override;
+
+private:
+  GLuint m_seedVBO = 0;
+
+  glm::mat4 m_projection;
+  glm::mat4 m_modelView;
+  float m_time = 0.0f;
+  float m_pointSize = 0.0f;
+  const float* m_energies = nullptr;
+
+  GLint m_uProjMatrix = -1;
+  GLint m_uModelMatrix = -1;
+  GLint m_uPointSize = -1;
+  GLint m_uTime = -1;
+  GLint m_uEnergy = -1;
+  GLint m_hSeed = -1;
+};
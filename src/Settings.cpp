@@ -0,0 +1,54 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "Settings.h"
+
+bool SpectrumSettings::Set(const std::string& settingName, int value)
+{
+  bool found = false;
+  ForEach([&](const char* name, int& field) {
+    if (!found && settingName == name)
+    {
+      field = value;
+      found = true;
+    }
+  });
+  return found;
+}
+
+bool IsOutputSetting(const std::string& settingName)
+{
+  return settingName == "capture" || settingName == "statistics" || settingName == "shared_memory";
+}
+
+void CSettingsQueue::Reset(const SpectrumSettings& settings)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_pending = settings;
+  m_changed = false;
+}
+
+bool CSettingsQueue::Set(const std::string& settingName, int value)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_pending.Set(settingName, value))
+    return false;
+
+  m_changed = true;
+  return true;
+}
+
+bool CSettingsQueue::Take(SpectrumSettings& settings)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_changed)
+    return false;
+
+  settings = m_pending;
+  m_changed = false;
+  return true;
+}
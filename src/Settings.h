@@ -0,0 +1,85 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <string>
+
+// Values of all integer settings of the add-on, as found in settings.xml.
+// Handed around as a whole so derived state is rebuilt once per batch of
+// changes instead of once per changed setting.
+struct SpectrumSettings
+{
+  int mode = 0;
+  int particles = 0;
+  int pointSize = 3;
+  int barHeight = 1;
+  int scaling = 0;
+  int autoGain = 0;
+  int speed = 2;
+  int rotationAngle = -15;
+  int beatEffect = 0;
+  int channelMode = 0;
+  int windowSize = 2;
+  int overlap = 2;
+  int outputDelay = 0;
+  int renderScale = 0;
+
+  // Store the value of the named setting, returns false for unknown names
+  bool Set(const std::string& settingName, int value);
+
+  // Call func(name, value) for every setting, value is a reference to the
+  // field so it can be read or filled in
+  template<typename Func>
+  void ForEach(Func func);
+};
+
+// The boolean settings of the opt-in outputs: capture, statistics and
+// shared_memory. Start() reads them, a change takes effect with the next
+// song.
+bool IsOutputSetting(const std::string& settingName);
+
+// Collects setting changes arriving from Kodi's thread. The render thread
+// takes over the latest snapshot at the start of a frame, so any number of
+// changes between two frames is applied once and never while a frame is
+// being prepared.
+class CSettingsQueue
+{
+public:
+  void Reset(const SpectrumSettings& settings);
+
+  // Record a change, returns false for unknown names
+  bool Set(const std::string& settingName, int value);
+
+  // Copy the latest snapshot if anything changed since the last call
+  bool Take(SpectrumSettings& settings);
+
+private:
+  std::mutex m_mutex;
+  SpectrumSettings m_pending;
+  bool m_changed = false;
+};
+
+template<typename Func>
+void SpectrumSettings::ForEach(Func func)
+{
+  func("mode", mode);
+  func("particles", particles);
+  func("pointsize", pointSize);
+  func("bar_height", barHeight);
+  func("scaling", scaling);
+  func("auto_gain", autoGain);
+  func("speed", speed);
+  func("rotation_angle", rotationAngle);
+  func("beat_effect", beatEffect);
+  func("channel_mode", channelMode);
+  func("window_size", windowSize);
+  func("overlap", overlap);
+  func("output_delay", outputDelay);
+  func("render_scale", renderScale);
+}
@@ -0,0 +1,241 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "SpectrumAnalyzer.h"
+
+#include <algorithm>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace
+{
+
+// Historic band layout of the visualization, band edges for 256 bins
+const int kBandScale[] = {0, 1, 2, 3, 5, 7, 10, 14, 20, 28, 40, 54, 74, 101, 137, 187, 255};
+const int kBandScaleBands = sizeof(kBandScale) / sizeof(kBandScale[0]) - 1;
+
+// Below this window size a frame is cheaper to analyse than to hand over to
+// another thread
+const int kMinParallelWindow = 1024;
+const int kMaxPoolThreads = 3;
+
+} // namespace
+
+bool CSpectrumAnalyzer::Configure(int channels, int samplesPerSec, int windowSize, int hopSize, int bands, bool separateChannels)
+{
+  if (windowSize < 2 || (windowSize & (windowSize - 1)) != 0 || hopSize <= 0 || hopSize > windowSize || bands <= 0)
+    return false;
+
+  m_channels = std::max(channels, 1);
+  m_samplesPerSec = samplesPerSec > 0 ? samplesPerSec : 44100;
+  m_windowSize = windowSize;
+  m_hopSize = hopSize;
+  m_bands = bands;
+
+  // Hann window, magnitudes are normalized by its coherent gain
+  m_window.resize(windowSize);
+  float sum = 0.0f;
+  for (int i = 0; i < windowSize; i++)
+  {
+    m_window[i] = 0.5f - 0.5f * cosf(float(2.0 * M_PI * i / windowSize));
+    sum += m_window[i];
+  }
+  m_normalize = 2.0f / sum;
+
+  // Stretch the historic band layout over the bins of this window size
+  const int bins = windowSize / 2;
+  m_bandEdges.resize(bands + 1);
+  for (int i = 0; i <= bands; i++)
+  {
+    const float pos = float(i) * kBandScaleBands / bands;
+    const int index = std::min(int(pos), kBandScaleBands - 1);
+    const float edge = kBandScale[index] + (pos - index) * (kBandScale[index + 1] - kBandScale[index]);
+    m_bandEdges[i] = std::min(int(edge * bins / 256.0f + 0.5f), bins);
+    if (i > 0 && m_bandEdges[i] <= m_bandEdges[i - 1])
+      m_bandEdges[i] = std::min(m_bandEdges[i - 1] + 1, bins);
+  }
+
+  const int analysed = separateChannels ? std::min(m_channels, MAX_ANALYSIS_CHANNELS) : 1;
+  if (m_channelState.size() < size_t(analysed))
+    m_channelState.resize(analysed);
+  m_analysed = analysed;
+  for (int c = 0; c < analysed; c++)
+  {
+    ChannelState& state = m_channelState[c];
+    state.fft.Init(windowSize);
+    state.fifo.resize(windowSize);
+    state.input.resize(windowSize);
+    state.magnitudes.resize(bins);
+  }
+
+  for (SpectrumFrame& frame : m_frames)
+    frame.bands.resize(bands * analysed);
+
+  // Channels are analysed in parallel only when there is enough work per
+  // frame to be worth the hand over
+  m_parallel = analysed > 1 && windowSize >= kMinParallelWindow && m_pool.Threads() > 0;
+
+  Reset();
+  return true;
+}
+
+void CSpectrumAnalyzer::StartThreads(int channels)
+{
+  const int cores = int(std::thread::hardware_concurrency());
+  const int threads = std::max(std::min({ std::min(channels, MAX_ANALYSIS_CHANNELS) - 1, cores - 1, kMaxPoolThreads }), 0);
+  if (threads == m_pool.Threads())
+    return;
+
+  m_pool.Start(threads);
+}
+
+void CSpectrumAnalyzer::Reset()
+{
+  for (int c = 0; c < m_analysed; c++)
+    std::fill(m_channelState[c].fifo.begin(), m_channelState[c].fifo.end(), 0.0f);
+  m_fifoPos = 0;
+  m_untilHop = m_hopSize;
+  m_samplePos = 0;
+}
+
+void CSpectrumAnalyzer::Reserve(CArena& arena, int maxChannels, int maxWindowSize, int bands)
+{
+  const int channels = std::min(std::max(maxChannels, 1), MAX_ANALYSIS_CHANNELS);
+
+  ReserveBuffer(m_window, arena, maxWindowSize);
+  ReserveBuffer(m_bandEdges, arena, bands + 1);
+
+  ReserveBuffer(m_channelState, arena, channels);
+  m_channelState.resize(channels);
+  for (ChannelState& state : m_channelState)
+  {
+    state.fft.Reserve(arena, maxWindowSize);
+    ReserveBuffer(state.fifo, arena, maxWindowSize);
+    ReserveBuffer(state.input, arena, maxWindowSize);
+    ReserveBuffer(state.magnitudes, arena, maxWindowSize / 2);
+  }
+
+  ReserveBuffer(m_frames, arena, kReservedFrames);
+  m_frames.resize(kReservedFrames);
+  for (SpectrumFrame& frame : m_frames)
+    ReserveBuffer(frame.bands, arena, bands * channels);
+
+  m_reserved = true;
+  m_windowSize = 0;
+  m_analysed = 0;
+}
+
+size_t CSpectrumAnalyzer::MemoryUsage() const
+{
+  size_t bytes = BufferBytes(m_window) + BufferBytes(m_bandEdges) + BufferBytes(m_channelState) +
+                 BufferBytes(m_frames);
+  for (const ChannelState& state : m_channelState)
+    bytes += state.fft.MemoryUsage() + BufferBytes(state.fifo) + BufferBytes(state.input) +
+             BufferBytes(state.magnitudes);
+  for (const SpectrumFrame& frame : m_frames)
+    bytes += BufferBytes(frame.bands);
+  return bytes;
+}
+
+float CSpectrumAnalyzer::BandFrequency(int band) const
+{
+  const float lo = float(std::max(m_bandEdges[band], 1));
+  const float hi = float(std::max(m_bandEdges[band + 1], m_bandEdges[band] + 1));
+  return sqrtf(lo * hi) * m_samplesPerSec / m_windowSize;
+}
+
+size_t CSpectrumAnalyzer::Process(const float* audioData, size_t audioDataLength)
+{
+  if (!m_windowSize)
+    return 0;
+
+  size_t count = 0;
+  const size_t samples = audioDataLength / m_channels;
+  const int analysed = Channels();
+
+  for (size_t i = 0; i < samples; i++)
+  {
+    const float* sample = &audioData[i * m_channels];
+    if (analysed == 1)
+    {
+      // Downmix to mono
+      float mono = sample[0];
+      for (int c = 1; c < m_channels; c++)
+        mono += sample[c];
+      m_channelState[0].fifo[m_fifoPos] = mono / m_channels;
+    }
+    else
+    {
+      for (int c = 0; c < analysed; c++)
+        m_channelState[c].fifo[m_fifoPos] = sample[c];
+    }
+
+    if (++m_fifoPos == size_t(m_windowSize))
+      m_fifoPos = 0;
+    m_samplePos++;
+
+    if (--m_untilHop == 0)
+    {
+      m_untilHop = m_hopSize;
+
+      // Frames are kept between calls so their band storage is reused.
+      // Reserved frames are never added to, the newest replaces the last.
+      if (count == m_frames.size())
+      {
+        if (m_reserved)
+        {
+          count--;
+        }
+        else
+        {
+          m_frames.emplace_back();
+          m_frames.back().bands.resize(m_bands * analysed);
+        }
+      }
+
+      SpectrumFrame& frame = m_frames[count++];
+      if (m_parallel)
+      {
+        m_pool.Run(analysed, [&](size_t c) {
+          Analyze(m_channelState[c], &frame.bands[c * m_bands]);
+        });
+      }
+      else
+      {
+        for (int c = 0; c < analysed; c++)
+          Analyze(m_channelState[c], &frame.bands[c * m_bands]);
+      }
+      frame.timestamp = (double(m_samplePos) - m_windowSize / 2) / m_samplesPerSec;
+    }
+  }
+
+  return count;
+}
+
+void CSpectrumAnalyzer::Analyze(ChannelState& state, float* bands)
+{
+  // Unroll the FIFO, oldest sample first, and apply the window
+  const size_t size = state.fifo.size();
+  const size_t first = size - m_fifoPos;
+  for (size_t i = 0; i < first; i++)
+    state.input[i] = state.fifo[m_fifoPos + i] * m_window[i];
+  for (size_t i = first; i < size; i++)
+    state.input[i] = state.fifo[i - first] * m_window[i];
+
+  state.fft.Magnitudes(state.input.data(), state.magnitudes.data());
+
+  for (int band = 0; band < m_bands; band++)
+  {
+    float peak = 0.0f;
+    for (int bin = m_bandEdges[band]; bin < m_bandEdges[band + 1]; bin++)
+      peak = std::max(peak, state.magnitudes[bin]);
+    bands[band] = peak * m_normalize;
+  }
+}
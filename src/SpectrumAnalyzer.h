@@ -0,0 +1,103 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include "FFT.h"
+#include "Memory.h"
+#include "TaskPool.h"
+
+#include <cstddef>
+#include <stdint.h>
+
+#define MAX_ANALYSIS_CHANNELS 8
+
+struct SpectrumFrame
+{
+  // Stream time in seconds of the center of the analysed window, counted
+  // from Start()
+  double timestamp = 0.0;
+
+  // Peak magnitude per band, 1.0 is a full scale sine. With separate
+  // channels the bands of all channels follow each other.
+  ArenaVector<float> bands;
+};
+
+// Streaming spectrum analysis. Incoming samples are collected in a FIFO and
+// one frame is produced every hop samples from the last window samples, so
+// the frame rate depends only on the sample rate and not on how much audio
+// Kodi hands over per call.
+class CSpectrumAnalyzer
+{
+public:
+  // With separateChannels up to MAX_ANALYSIS_CHANNELS channels are analysed
+  // independently, otherwise all channels are mixed down to one
+  bool Configure(int channels, int samplesPerSec, int windowSize, int hopSize, int bands, bool separateChannels);
+  void Reset();
+
+  // Start the threads to analyse up to channels channels in parallel. Call
+  // once per stream before Configure(), which then only decides whether to
+  // use them, so setting changes never start or stop threads.
+  void StartThreads(int channels);
+
+  // Carve all buffers from arena, sized for up to maxChannels analysed
+  // channels, windows of up to maxWindowSize samples and bands bands per
+  // channel. Configure() has to be called again afterwards. Audio handed over
+  // in one call then yields at most kReservedFrames frames, further ones
+  // replace the last.
+  static const size_t kReservedFrames = 32;
+  void Reserve(CArena& arena, int maxChannels, int maxWindowSize, int bands);
+  size_t MemoryUsage() const;
+
+  // Feed interleaved samples, returns the number of frames produced. The
+  // frames stay valid until the next call.
+  size_t Process(const float* audioData, size_t audioDataLength);
+  const SpectrumFrame& Frame(size_t index) const { return m_frames[index]; }
+
+  int Channels() const { return m_analysed; }
+  int Bands() const { return m_bands; }
+  int WindowSize() const { return m_windowSize; }
+  int HopSize() const { return m_hopSize; }
+  int SampleRate() const { return m_samplesPerSec; }
+
+  // Center frequency of a band in Hz, geometric mean of its bin range
+  float BandFrequency(int band) const;
+
+  // Stream time in seconds of the newest sample fed in
+  double StreamTime() const { return double(m_samplePos) / m_samplesPerSec; }
+
+private:
+  struct ChannelState
+  {
+    CFFT fft;
+    ArenaVector<float> fifo;
+    ArenaVector<float> input;
+    ArenaVector<float> magnitudes;
+  };
+
+  void Analyze(ChannelState& state, float* bands);
+
+  int m_channels = 1;
+  int m_samplesPerSec = 44100;
+  int m_windowSize = 0;
+  int m_hopSize = 0;
+  int m_bands = 0;
+  int m_analysed = 0;
+  bool m_reserved = false;
+  bool m_parallel = false;
+
+  // Channel states beyond m_analysed are kept for their buffers
+  ArenaVector<float> m_window;
+  ArenaVector<int> m_bandEdges;
+  ArenaVector<ChannelState> m_channelState;
+  ArenaVector<SpectrumFrame> m_frames;
+  CTaskPool m_pool;
+  size_t m_fifoPos = 0;
+  int m_untilHop = 0;
+  uint64_t m_samplePos = 0;
+  float m_normalize = 1.0f;
+};
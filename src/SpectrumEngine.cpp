@@ -0,0 +1,695 @@
+/*
+ *  Copyright (C) 1998-2000 Peter Alm, Mikael Alm, Olle Hallnas, Thomas Nilsson and 4Front Technologies
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#define __STDC_LIMIT_MACROS
+
+#include "SpectrumEngine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace
+{
+
+// The row queue holds the largest output_delay setting at the smallest hop,
+// a window of 512 samples at 87.5% overlap, plus room for the rows of one
+// Kodi buffer and a late frame
+const int kMaxOutputDelayMs = 500;
+const int kMinHopSize = 512 / 8;
+const int kQueueSlackMs = 100;
+
+// Kodi holds back at most this many buffers
+const int kMaxSyncBuffers = 15;
+
+// Time in seconds the beat pulse takes to fade out
+const double kBeatPulseTime = 0.25;
+
+// Largest FFT window of the window_size setting
+const int kMaxWindowSize = 4096;
+
+// Rows the queue needs at this sample rate
+size_t QueueRows(int samplesPerSec)
+{
+  const double rowsPerSecond = double(std::max(samplesPerSec, 1)) / kMinHopSize;
+  return size_t(ceil(rowsPerSecond * (kMaxOutputDelayMs + kQueueSlackMs) / 1000.0));
+}
+
+// FFT window size in samples for the window_size setting
+int WindowSize(int settingValue)
+{
+  switch (settingValue)
+  {
+  case 0:
+    return 512;
+
+  case 1:
+    return 1024;
+
+  case 3:
+    return kMaxWindowSize;
+
+  case 2:
+  default:
+    return 2048;
+  }
+}
+
+// Hops per window for the overlap setting
+int Overlap(int settingValue)
+{
+  switch (settingValue)
+  {
+  case 0://none
+    return 1;
+
+  case 1://50%
+    return 2;
+
+  case 3://87.5%
+    return 8;
+
+  case 2://75%
+  default:
+    return 4;
+  }
+}
+
+// Scale of the bars for the bar_height setting
+float BarHeight(int settingValue)
+{
+  switch (settingValue)
+  {
+  case 1://standard
+    return 1.0f;
+
+  case 2://big
+    return 2.0f;
+
+  case 3://real big
+    return 3.0f;
+
+  case 0://small
+  default:
+    return 0.5f;
+  }
+}
+
+CBandScaler::Curve ScalingCurve(int settingValue)
+{
+  switch (settingValue)
+  {
+  case 1:
+    return CBandScaler::kLinear;
+
+  case 2:
+    return CBandScaler::kDecibel;
+
+  case 3:
+    return CBandScaler::kAWeighted;
+
+  case 0:
+  default:
+    return CBandScaler::kLogarithmic;
+  }
+}
+
+CAutoGain::Mode AutoGainMode(int settingValue)
+{
+  switch (settingValue)
+  {
+  case 1:
+    return CAutoGain::kSlow;
+
+  case 2:
+    return CAutoGain::kFast;
+
+  case 0:
+  default:
+    return CAutoGain::kOff;
+  }
+}
+
+// Step per frame of the bar animation for the speed setting
+float AnimationStep(int settingValue)
+{
+  switch (settingValue)
+  {
+  case 1:
+    return 0.025f;
+
+  case 2:
+    return 0.0125f;
+
+  case 3:
+    return 0.1f;
+
+  case 4:
+    return 0.2f;
+
+  case 0:
+  default:
+    return 0.05f;
+  }
+}
+
+int ChannelMode(int settingValue)
+{
+  switch (settingValue)
+  {
+  case 1://side by side
+  case 2://mirrored
+    return settingValue;
+
+  case 0://mixed
+  default:
+    return 0;
+  }
+}
+
+} // namespace
+
+CSpectrumEngine::CSpectrumEngine(int rows, int cols)
+  : m_bandsPerChannel(cols),
+    m_pendingCols(cols),
+    m_hSpeed(0.05f)
+{
+  m_bars.Resize(rows, cols);
+  m_queueRows = QueueRows(m_samplesPerSec);
+  ResetQueue();
+  ConfigureAnalyzer();
+}
+
+void CSpectrumEngine::Start(int channels, int samplesPerSec, int bitsPerSample, const std::string& songName)
+{
+  m_capture.WriteStart(channels, samplesPerSec, bitsPerSample, songName);
+
+  {
+    std::unique_lock<std::mutex> lock(m_analysisMutex);
+    m_channels = channels;
+    m_samplesPerSec = samplesPerSec;
+    m_analyzer.StartThreads(channels);
+    ConfigureAnalyzer();
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_bars.Clear();
+  m_earlyRows = 0;
+  if (m_queueRows != QueueRows(samplesPerSec))
+  {
+    m_queueRows = QueueRows(samplesPerSec);
+    ResetQueue();
+  }
+}
+
+void CSpectrumEngine::AudioData(const float* pAudioData, size_t iAudioDataLength)
+{
+  // Captured under the analysis lock, so StopOutputs() cannot close the
+  // capture and the other outputs between a buffer's record and its rows
+  std::unique_lock<std::mutex> analysisLock(m_analysisMutex);
+  m_capture.WriteAudio(pAudioData, iAudioDataLength);
+  const size_t frames = m_analyzer.Process(pAudioData, iAudioDataLength);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_streamTime = m_analyzer.StreamTime();
+  m_deliveryTime = Now();
+  m_bufferDuration = double(iAudioDataLength) / std::max(m_channels, 1) / m_analyzer.SampleRate();
+  if (!frames)
+    return;
+
+  // Frames analysed before a pending grid resize has been applied are
+  // dropped
+  const int bands = m_analyzer.Bands();
+  const int channels = m_analyzer.Channels();
+  const int cols = m_bars.Cols();
+  if (cols != bands * channels)
+    return;
+
+  // Every analysed frame becomes one row of the grid, channels side by side.
+  // When mirrored every other channel runs from high to low frequencies so
+  // neighbouring channels meet at the bass.
+  for (size_t f = 0; f < frames; f++)
+  {
+    const SpectrumFrame& frame = m_analyzer.Frame(f);
+
+    // A full queue shows its oldest row right away, before the output delay
+    // is fully made up for
+    if (m_queueCount == m_queueRows)
+    {
+      PresentRow();
+      m_earlyRows++;
+    }
+
+    const size_t slot = (m_queueHead + m_queueCount++) % m_queueRows;
+    float* heights = &m_queue[slot * cols];
+    m_queueTimes[slot] = frame.timestamp;
+    m_queueBeats[slot] = m_beats.Process(frame.bands.data(), frame.bands.size(), frame.timestamp);
+    m_queueFullHeights[slot] = m_barHeight;
+
+    const float gain = m_autoGain.Process(frame.bands.data(), frame.bands.size());
+    for (int c = 0; c < channels; c++)
+    {
+      float* channel = &heights[c * bands];
+      m_scaler.Apply(&frame.bands[c * bands], channel, gain);
+      if (m_channelMode == 2 && (c & 1) == 0)
+        std::reverse(channel, channel + bands);
+    }
+
+    if (m_export.IsOpen())
+      m_export.Publish(frame.timestamp, heights, cols);
+  }
+}
+
+bool CSpectrumEngine::Animate(bool animateBars)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  const double now = Now();
+  if (m_lastAnimate >= 0.0)
+    m_frameInterval += (std::min(now - m_lastAnimate, 0.25) - m_frameInterval) * 0.05;
+  m_lastAnimate = now;
+
+  bool changed = false;
+  if (m_pendingCols != m_bars.Cols())
+  {
+    m_bars.Resize(m_bars.Rows(), m_pendingCols);
+    ResetQueue();
+    changed = true;
+  }
+
+  // Kodi already held back m_syncBuffers buffers, and the animation adds
+  // its own delay on top of the row being shown
+  const double delay = m_outputDelayMs / 1000.0 - std::max(m_syncBuffers, 0) * m_bufferDuration - SmoothingLatency();
+  const double audioClock = m_streamTime + (now - m_deliveryTime) - delay;
+  m_beatPulse = std::max(m_beatPulse - static_cast<float>(m_frameInterval / kBeatPulseTime), 0.0f);
+  while (m_queueCount && m_queueTimes[m_queueHead] <= audioClock)
+  {
+    PresentRow();
+    changed = true;
+  }
+
+  if (animateBars)
+    m_bars.Animate(m_hSpeed);
+  return changed;
+}
+
+float CSpectrumEngine::Speed()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return m_hSpeed;
+}
+
+void CSpectrumEngine::SetCurrentHeights(const float* heights, size_t count)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (count == m_bars.Count())
+    std::copy(heights, heights + count, m_bars.Current());
+}
+
+float CSpectrumEngine::FullHeight()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return m_fullHeight;
+}
+
+uint64_t CSpectrumEngine::EarlyRows()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return m_earlyRows;
+}
+
+bool CSpectrumEngine::SetSetting(const std::string& settingName, int value)
+{
+  if (settingName == "bar_height")
+  {
+    SetBarHeightSetting(value);
+    return true;
+  }
+  else if (settingName == "scaling")
+  {
+    SetScalingSetting(value);
+    return true;
+  }
+  else if (settingName == "auto_gain")
+  {
+    SetAutoGainSetting(value);
+    return true;
+  }
+  else if (settingName == "speed")
+  {
+    SetSpeedSetting(value);
+    return true;
+  }
+  else if (settingName == "window_size")
+  {
+    SetWindowSizeSetting(value);
+    return true;
+  }
+  else if (settingName == "overlap")
+  {
+    SetOverlapSetting(value);
+    return true;
+  }
+  else if (settingName == "channel_mode")
+  {
+    SetChannelModeSetting(value);
+    return true;
+  }
+  else if (settingName == "output_delay")
+  {
+    SetOutputDelaySetting(value);
+    return true;
+  }
+
+  return false;
+}
+
+void CSpectrumEngine::ApplySettings(const SpectrumSettings& settings)
+{
+  std::unique_lock<std::mutex> settingsLock(m_settingsMutex);
+  const float barHeight = BarHeight(settings.barHeight);
+  const CBandScaler::Curve curve = ScalingCurve(settings.scaling);
+  const CAutoGain::Mode autoGainMode = AutoGainMode(settings.autoGain);
+  const int windowSize = WindowSize(settings.windowSize);
+  const int hopSize = windowSize / Overlap(settings.overlap);
+  const int channelMode = ChannelMode(settings.channelMode);
+
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_hSpeed = AnimationStep(settings.speed);
+    m_outputDelayMs = std::max(settings.outputDelay, 0);
+  }
+
+  // The analysis state only changes with m_settingsMutex held, so it can be
+  // compared without waiting for AudioData(). Every part is rebuilt at most
+  // once, reconfiguring the analyzer rebuilds all of them and restarts the
+  // analysis.
+  const bool analyzerChanged = windowSize != m_windowSize || hopSize != m_hopSize || channelMode != m_channelMode;
+  const bool scalerChanged = barHeight != m_barHeight || curve != m_curve;
+  const bool autoGainChanged = autoGainMode != m_autoGainMode;
+  if (!analyzerChanged && !scalerChanged && !autoGainChanged)
+    return;
+
+  std::unique_lock<std::mutex> lock(m_analysisMutex);
+  m_barHeight = barHeight;
+  m_curve = curve;
+  m_autoGainMode = autoGainMode;
+  m_windowSize = windowSize;
+  m_hopSize = hopSize;
+  m_channelMode = channelMode;
+  if (analyzerChanged)
+  {
+    ConfigureAnalyzer();
+    return;
+  }
+
+  if (scalerChanged)
+    ConfigureScaler();
+  if (autoGainChanged)
+    m_autoGain.Configure(m_autoGainMode, double(m_analyzer.SampleRate()) / m_analyzer.HopSize());
+}
+
+void CSpectrumEngine::SetBarHeightSetting(int settingValue)
+{
+  std::unique_lock<std::mutex> settingsLock(m_settingsMutex);
+  std::unique_lock<std::mutex> lock(m_analysisMutex);
+  m_barHeight = BarHeight(settingValue);
+  ConfigureScaler();
+}
+
+void CSpectrumEngine::SetScalingSetting(int settingValue)
+{
+  std::unique_lock<std::mutex> settingsLock(m_settingsMutex);
+  std::unique_lock<std::mutex> lock(m_analysisMutex);
+  m_curve = ScalingCurve(settingValue);
+  ConfigureScaler();
+}
+
+void CSpectrumEngine::SetAutoGainSetting(int settingValue)
+{
+  std::unique_lock<std::mutex> settingsLock(m_settingsMutex);
+  std::unique_lock<std::mutex> lock(m_analysisMutex);
+  m_autoGainMode = AutoGainMode(settingValue);
+  m_autoGain.Configure(m_autoGainMode, double(m_analyzer.SampleRate()) / m_analyzer.HopSize());
+}
+
+void CSpectrumEngine::SetSpeedSetting(int settingValue)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_hSpeed = AnimationStep(settingValue);
+}
+
+void CSpectrumEngine::SetWindowSizeSetting(int settingValue)
+{
+  std::unique_lock<std::mutex> settingsLock(m_settingsMutex);
+  std::unique_lock<std::mutex> lock(m_analysisMutex);
+  const int overlap = m_windowSize / m_hopSize;
+  m_windowSize = WindowSize(settingValue);
+  m_hopSize = m_windowSize / overlap;
+  ConfigureAnalyzer();
+}
+
+void CSpectrumEngine::SetOverlapSetting(int settingValue)
+{
+  std::unique_lock<std::mutex> settingsLock(m_settingsMutex);
+  std::unique_lock<std::mutex> lock(m_analysisMutex);
+  m_hopSize = m_windowSize / Overlap(settingValue);
+  ConfigureAnalyzer();
+}
+
+void CSpectrumEngine::SetChannelModeSetting(int settingValue)
+{
+  std::unique_lock<std::mutex> settingsLock(m_settingsMutex);
+  std::unique_lock<std::mutex> lock(m_analysisMutex);
+  m_channelMode = ChannelMode(settingValue);
+  ConfigureAnalyzer();
+}
+
+void CSpectrumEngine::SetOutputDelaySetting(int settingValue)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_outputDelayMs = std::max(settingValue, 0);
+}
+
+double CSpectrumEngine::Latency()
+{
+  std::unique_lock<std::mutex> analysisLock(m_analysisMutex);
+  const double analysis = (m_windowSize + m_hopSize) / 2.0 / m_samplesPerSec;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return analysis + SmoothingLatency();
+}
+
+int CSpectrumEngine::SyncDelay()
+{
+  const double latency = Latency();
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_syncBuffers < 0)
+  {
+    // Only the part of the output delay not already covered by our own
+    // latency needs to be held back, in whole buffers
+    const double missing = m_outputDelayMs / 1000.0 - latency;
+    m_syncBuffers = missing > 0.0 ? std::min(int(missing / m_bufferDuration), kMaxSyncBuffers) : 0;
+  }
+  return m_syncBuffers;
+}
+
+float CSpectrumEngine::AutoGain()
+{
+  std::unique_lock<std::mutex> lock(m_analysisMutex);
+  return m_autoGain.GainDecibels();
+}
+
+double CSpectrumEngine::Tempo()
+{
+  std::unique_lock<std::mutex> lock(m_analysisMutex);
+  return m_beats.Tempo();
+}
+
+void CSpectrumEngine::SetClock(std::function<double()> clock)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_clock = std::move(clock);
+}
+
+double CSpectrumEngine::Now() const
+{
+  if (m_clock)
+    return m_clock();
+
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double CSpectrumEngine::SmoothingLatency() const
+{
+  // Frames a bar needs to cover a quarter of the full height, plus the
+  // frame the renderer prepares ahead
+  return (0.25 / m_hSpeed + 1.0) * m_frameInterval;
+}
+
+void CSpectrumEngine::ConfigureAnalyzer()
+{
+  m_analyzer.Configure(m_channels, m_samplesPerSec, m_windowSize, m_hopSize, m_bandsPerChannel, m_channelMode != 0);
+  m_beats.Reset(double(m_analyzer.SampleRate()) / m_analyzer.HopSize());
+  m_autoGain.Configure(m_autoGainMode, double(m_analyzer.SampleRate()) / m_analyzer.HopSize());
+  ConfigureScaler();
+
+  // The grid gets one block of bands per analysed channel. Timestamps start
+  // again at 0, so rows still queued are of no use anymore.
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_pendingCols = m_bandsPerChannel * m_analyzer.Channels();
+  m_queueCount = 0;
+  m_streamTime = 0.0;
+}
+
+void CSpectrumEngine::ConfigureScaler()
+{
+  m_scaler.Configure(m_curve, m_barHeight, m_analyzer.Bands());
+  for (int band = 0; band < m_analyzer.Bands(); band++)
+    m_scaler.SetBandFrequency(band, m_analyzer.BandFrequency(band));
+}
+
+void CSpectrumEngine::ResetQueue()
+{
+  m_queue.assign(m_queueRows * m_bars.Cols(), 0.0f);
+  m_queueTimes.assign(m_queueRows, 0.0);
+  m_queueBeats.assign(m_queueRows, 0);
+  m_queueFullHeights.assign(m_queueRows, 1.0f);
+  m_queueHead = 0;
+  m_queueCount = 0;
+}
+
+void CSpectrumEngine::PresentRow()
+{
+  const int cols = m_bars.Cols();
+  const float* heights = &m_queue[m_queueHead * cols];
+  memcpy(m_bars.PushRow(), heights, cols * sizeof(float));
+  if (m_queueBeats[m_queueHead])
+    m_beatPulse = 1.0f;
+
+  // The statistics count what is shown, against the scale it was shown at
+  m_fullHeight = m_queueFullHeights[m_queueHead];
+  if (m_statistics.IsEnabled())
+    m_statistics.Add(m_queueTimes[m_queueHead], heights, cols, m_fullHeight);
+  m_queueHead = (m_queueHead + 1) % m_queueRows;
+  m_queueCount--;
+}
+
+int CSpectrumEngine::MaxCols(int channels) const
+{
+  return m_bandsPerChannel * std::min(std::max(channels, 1), MAX_ANALYSIS_CHANNELS);
+}
+
+void CSpectrumEngine::ReserveBuffers(CArena& arena, int channels, int samplesPerSec)
+{
+  const int maxCols = MaxCols(channels);
+
+  {
+    std::unique_lock<std::mutex> lock(m_analysisMutex);
+    m_analyzer.Reserve(arena, maxCols / m_bandsPerChannel, kMaxWindowSize, m_bandsPerChannel);
+    m_beats.Reserve(arena, maxCols);
+    m_scaler.Reserve(arena, m_bandsPerChannel);
+    ConfigureAnalyzer();
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  const int rows = m_bars.Rows();
+  const int cols = m_bars.Cols();
+  m_bars.Reserve(arena, rows, maxCols);
+  m_bars.Resize(rows, cols);
+  m_queueRows = QueueRows(samplesPerSec);
+  ReserveBuffer(m_queue, arena, m_queueRows * maxCols);
+  ReserveBuffer(m_queueTimes, arena, m_queueRows);
+  ReserveBuffer(m_queueBeats, arena, m_queueRows);
+  ReserveBuffer(m_queueFullHeights, arena, m_queueRows);
+  ResetQueue();
+}
+
+void CSpectrumEngine::ReportMemory(CMemoryReport& report)
+{
+  {
+    std::unique_lock<std::mutex> lock(m_analysisMutex);
+    report.Add("analyzer", m_analyzer.MemoryUsage());
+    report.Add("beat detector", m_beats.MemoryUsage());
+    report.Add("band scaler", m_scaler.MemoryUsage());
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  report.Add("bar heights", m_bars.MemoryUsage());
+  report.Add("row queue", BufferBytes(m_queue) + BufferBytes(m_queueTimes) + BufferBytes(m_queueBeats) +
+                              BufferBytes(m_queueFullHeights));
+  if (m_export.IsOpen())
+    report.Add("shared memory", m_export.MemoryUsage());
+  if (m_statistics.IsEnabled())
+    report.Add("statistics", m_statistics.MemoryUsage());
+}
+
+bool CSpectrumEngine::StartCapture(const std::string& path)
+{
+  return m_capture.Open(path);
+}
+
+void CSpectrumEngine::StopCapture()
+{
+  m_capture.Close();
+}
+
+bool CSpectrumEngine::StartExport(const std::string& name, int channels)
+{
+  // Slots fit the widest row any setting can produce, so changing the
+  // grid never has to resize the shared memory
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return m_export.Open(name, MaxCols(channels));
+}
+
+void CSpectrumEngine::StopExport()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_export.Close();
+}
+
+void CSpectrumEngine::StartStatistics(int channels)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_statistics.Start(MaxCols(channels));
+}
+
+void CSpectrumEngine::StopStatistics()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_statistics.Stop();
+}
+
+bool CSpectrumEngine::IsCollectingStatistics()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return m_statistics.IsEnabled();
+}
+
+bool CSpectrumEngine::WriteStatistics(const std::string& path, StatisticsSummary& summary)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  summary = m_statistics.Summary();
+  return m_statistics.Write(path);
+}
+
+void CSpectrumEngine::StopOutputs()
+{
+  std::unique_lock<std::mutex> analysisLock(m_analysisMutex);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_capture.Close();
+  m_export.Close();
+  m_statistics.Stop();
+}
+
+void CSpectrumEngine::RecordSetting(const std::string& settingName, int value)
+{
+  m_capture.WriteSetting(settingName, value);
+}
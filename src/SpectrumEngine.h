@@ -0,0 +1,212 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include "AutoGain.h"
+#include "BandScaler.h"
+#include "BarHeights.h"
+#include "BeatDetector.h"
+#include "Capture.h"
+#include "Memory.h"
+#include "Settings.h"
+#include "SpectrumAnalyzer.h"
+#include "SpectrumExport.h"
+#include "SpectrumStatistics.h"
+
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+// Platform independent part of the visualization: turns the audio handed in
+// by Kodi into bar heights and animates them. Shared by the OpenGL and the
+// DirectX renderer and usable without Kodi, e.g. by the replay tool.
+//
+// AudioData() and Animate() may be called from different threads.
+//
+// Analysed rows are not shown right away but queued with their timestamp
+// and moved into the grid by Animate() once the estimated audio clock
+// reaches them. That way a configured audio output delay, e.g. of an AV
+// receiver, can be compensated.
+class CSpectrumEngine
+{
+public:
+  CSpectrumEngine(int rows, int cols);
+
+  void Start(int channels, int samplesPerSec, int bitsPerSample, const std::string& songName);
+  void AudioData(const float* audioData, size_t audioDataLength);
+
+  // Advance the bar animation by one rendered frame. Changes of the grid
+  // size, e.g. from the channel mode, are applied here too. With
+  // animateBars false only the targets are updated, for renderers that
+  // animate the heights on the GPU. Returns true if the targets changed.
+  bool Animate(bool animateBars = true);
+
+  // Apply the analysis and animation related settings, returns false for
+  // settings only the renderer knows about
+  bool SetSetting(const std::string& settingName, int value);
+  void SetBarHeightSetting(int settingValue);
+  void SetScalingSetting(int settingValue);
+  void SetAutoGainSetting(int settingValue);
+  void SetSpeedSetting(int settingValue);
+  void SetWindowSizeSetting(int settingValue);
+  void SetOverlapSetting(int settingValue);
+  void SetChannelModeSetting(int settingValue);
+  void SetOutputDelaySetting(int settingValue);
+
+  // Apply the engine part of a settings snapshot. The analyzer, the scaler
+  // and the automatic gain control are rebuilt at most once, and only if one
+  // of their settings changed. The analysis is not waited for otherwise.
+  void ApplySettings(const SpectrumSettings& settings);
+
+  // Delay in seconds from audio reaching the add-on to it being fully shown:
+  // half a window and half a hop of analysis, the bar animation and the
+  // frame prepared ahead by the renderer
+  double Latency();
+
+  // Number of audio buffers Kodi should hold back before handing them over,
+  // for GetInfo(). Kodi asks only once, so the value is fixed on the first
+  // call; the rest of the output delay is handled by the row queue.
+  int SyncDelay();
+
+  // Time source in seconds, the replay tool replaces it to run on the
+  // recorded timeline
+  void SetClock(std::function<double()> clock);
+  double Now() const;
+
+  // Only safe to read from the thread calling Animate()
+  const CBarHeights& Bars() const { return m_bars; }
+  // 1 on the frame a beat is shown, fading to 0 within a quarter second.
+  // Only safe to read from the thread calling Animate()
+  float BeatPulse() const { return m_beatPulse; }
+
+  // Step per frame of the bar animation, see CBarHeights::Animate()
+  float Speed();
+
+  // Continue the animation from heights a renderer animated itself while
+  // calling Animate(false). Ignored unless count matches the grid, which
+  // is cleared on a resize anyway.
+  void SetCurrentHeights(const float* heights, size_t count);
+
+  // Height of a full bar in the rows shown last, the bar height setting
+  // they were analysed with
+  float FullHeight();
+
+  // Rows shown before the output delay was made up for since Start(),
+  // because more were waiting than the queue holds
+  uint64_t EarlyRows();
+
+  // Gain in dB applied by the automatic gain control, 0 when off
+  float AutoGain();
+
+  // Current tempo estimate in beats per minute, 0 if not known
+  double Tempo();
+
+  // Number of grid columns the settings allow with this many channels
+  int MaxCols(int channels) const;
+
+  // Carve all analysis buffers, the grid and the row queue from arena,
+  // sized for the largest configuration the settings allow with this many
+  // channels at this sample rate, so no setting change needs to allocate.
+  // Call before Start() with the same values.
+  void ReserveBuffers(CArena& arena, int channels, int samplesPerSec);
+
+  // Add the bytes held by the analysis, the grid and the row queue
+  void ReportMemory(CMemoryReport& report);
+
+  // Opt-in recording of all calls from Kodi, see Capture.h for the format.
+  // Safe from any thread, also while AudioData() runs.
+  bool StartCapture(const std::string& path);
+  void StopCapture();
+  bool IsCapturing() const { return m_capture.IsOpen(); }
+  void RecordSetting(const std::string& settingName, int value);
+
+  // Opt-in publishing of every analysed row to shared memory for other
+  // processes, see SpectrumExport.h for the layout
+  bool StartExport(const std::string& name, int channels);
+  void StopExport();
+
+  // Opt-in statistics of the heights shown, see
+  // SpectrumStatistics.h. Nothing is collected or allocated unless started.
+  void StartStatistics(int channels);
+  void StopStatistics();
+  bool IsCollectingStatistics();
+  // CSV of the statistics so far, summary receives the totals written
+  bool WriteStatistics(const std::string& path, StatisticsSummary& summary);
+
+  // Close capture, export and statistics at once. AudioData() may still
+  // run on Kodi's audio thread: a buffer is either in all of them or in
+  // none.
+  void StopOutputs();
+
+private:
+  double SmoothingLatency() const;
+  void ConfigureAnalyzer();
+  void ConfigureScaler();
+  void ResetQueue();
+  void PresentRow();
+
+  // m_analysisMutex guards the analyzer and its configuration, m_mutex the
+  // bar heights and the values used to produce them. m_settingsMutex is held
+  // by setting changes, taken before the other two, and the configuration
+  // below is only changed with it held.
+  std::mutex m_settingsMutex;
+  std::mutex m_analysisMutex;
+  CSpectrumAnalyzer m_analyzer;
+  int m_channels = 2;
+  int m_samplesPerSec = 44100;
+  int m_windowSize = 2048;
+  int m_hopSize = 512;
+  int m_bandsPerChannel;
+  int m_channelMode = 0;
+  // Beats are detected on the analysed bands and shown along with their row
+  CBeatDetector m_beats;
+  // Band magnitudes to heights, per channel, after the automatic gain
+  // control over all channels
+  CAutoGain m_autoGain;
+  CAutoGain::Mode m_autoGainMode = CAutoGain::kOff;
+  CBandScaler m_scaler;
+  CBandScaler::Curve m_curve = CBandScaler::kLogarithmic;
+  float m_barHeight = 1.0f;
+
+  std::mutex m_mutex;
+  CBarHeights m_bars;
+  int m_pendingCols;
+  CCaptureWriter m_capture;
+  CSpectrumExportWriter m_export;
+  CSpectrumStatistics m_statistics;
+  float m_hSpeed;
+
+  // Ring of analysed rows waiting for the audio clock to reach them, sized
+  // for the sample rate in Start()
+  size_t m_queueRows = 0;
+  ArenaVector<float> m_queue;
+  ArenaVector<double> m_queueTimes;
+  ArenaVector<uint8_t> m_queueBeats;
+  // Bar height setting each row was scaled with, the height of a full bar
+  ArenaVector<float> m_queueFullHeights;
+  float m_fullHeight = 1.0f;
+  size_t m_queueHead = 0;
+  size_t m_queueCount = 0;
+  // Rows shown before their time because the queue was full
+  uint64_t m_earlyRows = 0;
+
+  // Audio clock estimate: stream time of the newest sample and when it
+  // arrived, the length of one Kodi buffer and the render frame interval
+  std::function<double()> m_clock;
+  double m_streamTime = 0.0;
+  double m_deliveryTime = 0.0;
+  double m_bufferDuration = 512.0 / (2 * 44100);
+  double m_frameInterval = 1.0 / 60;
+  double m_lastAnimate = -1.0;
+  int m_outputDelayMs = 0;
+  int m_syncBuffers = -1;
+
+  // Set when a row with a beat is shown, faded out by Animate()
+  float m_beatPulse = 0.0f;
+};
@@ -0,0 +1,228 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "SpectrumExport.h"
+
+#include <algorithm>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(__ANDROID__)
+#define SPECTRUM_HAS_SHM
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+const char kMagic[4] = { 'S', 'P', 'S', 'M' };
+const uint32_t kVersion = 1;
+
+// About three quarters of a second of rows with the default hop
+const uint32_t kSlots = 64;
+
+// Slots start on their own cache line
+const size_t kSlotAlignment = 64;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared memory needs address free atomics");
+static_assert(sizeof(SpectrumExportHeader) == 64, "header layout");
+static_assert(sizeof(SpectrumExportSlot) == 24, "slot layout");
+
+float* SlotHeights(uint8_t* slot)
+{
+  return reinterpret_cast<float*>(slot + sizeof(SpectrumExportSlot));
+}
+
+const float* SlotHeights(const uint8_t* slot)
+{
+  return reinterpret_cast<const float*>(slot + sizeof(SpectrumExportSlot));
+}
+
+} // namespace
+
+bool CSpectrumExportWriter::Open(const std::string& name, int maxCols)
+{
+  Close();
+
+#ifdef SPECTRUM_HAS_SHM
+  if (maxCols <= 0)
+    return false;
+
+  const size_t slotSize = (sizeof(SpectrumExportSlot) + maxCols * sizeof(float) + kSlotAlignment - 1) /
+                          kSlotAlignment * kSlotAlignment;
+  const size_t size = sizeof(SpectrumExportHeader) + kSlots * slotSize;
+
+  // Readers still mapping an object from an earlier session keep it, they
+  // see open drop to 0 and the new one under the same name
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0)
+    return false;
+
+  void* data = MAP_FAILED;
+  if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  // The new object is zero filled, so every slot starts with an even
+  // sequence and row 0 of no heights
+  m_name = name;
+  m_size = size;
+  m_slotCount = kSlots;
+  m_slotSize = static_cast<uint32_t>(slotSize);
+  m_maxCols = maxCols;
+  m_rows = 0;
+  m_header = static_cast<SpectrumExportHeader*>(data);
+  m_slots = static_cast<uint8_t*>(data) + sizeof(SpectrumExportHeader);
+
+  memcpy(m_header->magic, kMagic, sizeof(kMagic));
+  m_header->version = kVersion;
+  m_header->slots = m_slotCount;
+  m_header->maxCols = static_cast<uint32_t>(maxCols);
+  m_header->slotSize = m_slotSize;
+  m_header->open.store(1, std::memory_order_release);
+  return true;
+#else
+  (void)name;
+  (void)maxCols;
+  return false;
+#endif
+}
+
+void CSpectrumExportWriter::Close()
+{
+#ifdef SPECTRUM_HAS_SHM
+  if (!m_header)
+    return;
+
+  m_header->open.store(0, std::memory_order_release);
+  munmap(m_header, m_size);
+  shm_unlink(m_name.c_str());
+#endif
+  m_header = nullptr;
+  m_slots = nullptr;
+  m_size = 0;
+}
+
+void CSpectrumExportWriter::Publish(double timestamp, const float* heights, int cols)
+{
+  cols = std::min(std::max(cols, 0), m_maxCols);
+  uint8_t* data = m_slots + (m_rows % m_slotCount) * m_slotSize;
+  SpectrumExportSlot* slot = reinterpret_cast<SpectrumExportSlot*>(data);
+
+  // Odd while writing, the fence keeps the row from being written before
+  const uint32_t sequence = slot->sequence.load(std::memory_order_relaxed);
+  slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->cols = static_cast<uint32_t>(cols);
+  slot->row = m_rows;
+  slot->timestamp = timestamp;
+  memcpy(SlotHeights(data), heights, cols * sizeof(float));
+
+  slot->sequence.store(sequence + 2, std::memory_order_release);
+  m_header->rows.store(++m_rows, std::memory_order_release);
+}
+
+bool CSpectrumExportReader::Open(const std::string& name)
+{
+  Close();
+
+#ifdef SPECTRUM_HAS_SHM
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(SpectrumExportHeader))
+    data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  m_header = static_cast<const SpectrumExportHeader*>(data);
+  m_size = info.st_size;
+
+  // Only trust a layout that fits into the object
+  const SpectrumExportHeader& header = *m_header;
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion || !header.slots ||
+      header.slotSize < sizeof(SpectrumExportSlot) + header.maxCols * sizeof(float) ||
+      sizeof(SpectrumExportHeader) + static_cast<size_t>(header.slots) * header.slotSize > m_size)
+  {
+    Close();
+    return false;
+  }
+
+  m_slotCount = header.slots;
+  m_slotSize = header.slotSize;
+  m_maxCols = header.maxCols;
+  m_slots = reinterpret_cast<const uint8_t*>(m_header) + sizeof(SpectrumExportHeader);
+  return true;
+#else
+  (void)name;
+  return false;
+#endif
+}
+
+void CSpectrumExportReader::Close()
+{
+#ifdef SPECTRUM_HAS_SHM
+  if (m_header)
+    munmap(const_cast<SpectrumExportHeader*>(m_header), m_size);
+#endif
+  m_header = nullptr;
+  m_slots = nullptr;
+  m_size = 0;
+}
+
+bool CSpectrumExportReader::IsLive() const
+{
+  return m_header && m_header->open.load(std::memory_order_acquire);
+}
+
+uint32_t CSpectrumExportReader::Rows() const
+{
+  return m_header ? m_header->rows.load(std::memory_order_acquire) : 0;
+}
+
+bool CSpectrumExportReader::Read(uint32_t row, double& timestamp, std::vector<float>& heights) const
+{
+  // Rows are counted with wrapping, so compare the distance to the newest
+  const uint32_t age = Rows() - 1 - row;
+  if (!m_header || age >= m_slotCount)
+    return false;
+
+  const uint8_t* data = m_slots + (row % m_slotCount) * m_slotSize;
+  const SpectrumExportSlot* slot = reinterpret_cast<const SpectrumExportSlot*>(data);
+
+  // Retry a few times when the writer is busy with this very slot
+  for (int attempt = 0; attempt < 4; attempt++)
+  {
+    const uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence & 1)
+      continue;
+
+    const uint32_t cols = std::min(slot->cols, m_maxCols);
+    const uint32_t slotRow = slot->row;
+    timestamp = slot->timestamp;
+    heights.resize(cols);
+    memcpy(heights.data(), SlotHeights(data), cols * sizeof(float));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->sequence.load(std::memory_order_relaxed) == sequence)
+      return slotRow == row;
+  }
+  return false;
+}
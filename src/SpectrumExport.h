@@ -0,0 +1,120 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Export of the analysed rows to POSIX shared memory, so other local
+// processes, e.g. driving room lights, can use the same analysis without
+// running their own. Not available on Windows and Android.
+//
+// The shared memory object starts with a 64 byte header of
+//   char   magic[4]  "SPSM"
+//   uint32 version
+//   uint32 slots     rows kept in the ring
+//   uint32 maxCols   floats per slot
+//   uint32 slotSize  bytes per slot, a multiple of 64
+//   uint32 open      1 while the add-on publishes, 0 once it stopped
+//   uint32 rows      rows published so far, wrapping. The newest row is in
+//                    slot (rows - 1) % slots.
+// followed by the slots, each
+//   uint32 sequence  odd while the slot is written
+//   uint32 cols      heights in the row, channels side by side
+//   uint32 row       number of the row, as counted by rows
+//   uint32 reserved
+//   double timestamp stream time of the row in seconds
+//   float  heights[maxCols], scaled bar heights as queued for display
+// All values are in native byte order. Writing a row takes no system calls
+// and no locks: a reader copies a slot and keeps the copy only if the
+// sequence was the same even value before and after (a seqlock).
+//
+// The object is unlinked when the add-on stops. Readers should open it
+// again once open is 0 or the object went away.
+
+// Name the add-on publishes under
+constexpr char kSpectrumExportName[] = "/kodi-visualization-spectrum";
+
+struct SpectrumExportHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t slots;
+  uint32_t maxCols;
+  uint32_t slotSize;
+  std::atomic<uint32_t> open;
+  std::atomic<uint32_t> rows;
+  uint8_t reserved[36];
+};
+
+struct SpectrumExportSlot
+{
+  std::atomic<uint32_t> sequence;
+  uint32_t cols;
+  uint32_t row;
+  uint32_t reserved;
+  double timestamp;
+  // Followed by the heights
+};
+
+class CSpectrumExportWriter
+{
+public:
+  ~CSpectrumExportWriter() { Close(); }
+
+  // Create the shared memory object for rows of up to maxCols heights.
+  // An object of the same name left behind is replaced.
+  bool Open(const std::string& name, int maxCols);
+  void Close();
+  bool IsOpen() const { return m_header != nullptr; }
+
+  // Copy one row into the next slot. Rows longer than maxCols are cut.
+  void Publish(double timestamp, const float* heights, int cols);
+
+  uint32_t Rows() const { return m_rows; }
+  size_t MemoryUsage() const { return m_size; }
+
+private:
+  std::string m_name;
+  SpectrumExportHeader* m_header = nullptr;
+  uint8_t* m_slots = nullptr;
+  size_t m_size = 0;
+  uint32_t m_slotCount = 0;
+  uint32_t m_slotSize = 0;
+  int m_maxCols = 0;
+  uint32_t m_rows = 0;
+};
+
+class CSpectrumExportReader
+{
+public:
+  ~CSpectrumExportReader() { Close(); }
+
+  bool Open(const std::string& name);
+  void Close();
+
+  // False once the writer stopped
+  bool IsLive() const;
+  // Rows published so far, wrapping
+  uint32_t Rows() const;
+
+  // Copy the given row, returns false if it was not published yet, has
+  // already been overwritten or kept changing while copied
+  bool Read(uint32_t row, double& timestamp, std::vector<float>& heights) const;
+
+private:
+  const SpectrumExportHeader* m_header = nullptr;
+  const uint8_t* m_slots = nullptr;
+  size_t m_size = 0;
+  uint32_t m_slotCount = 0;
+  uint32_t m_slotSize = 0;
+  uint32_t m_maxCols = 0;
+};
@@ -0,0 +1,119 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "SpectrumStatistics.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace
+{
+
+// Longer gaps between rows, e.g. after the analysis restarted, do not count
+// as time spent at any height
+const double kMaxRowGap = 0.25;
+
+} // namespace
+
+void CSpectrumStatistics::Start(int maxCols)
+{
+  m_bands.assign(std::max(maxCols, 0), Band{});
+  m_rows = 0;
+  m_seconds = 0.0;
+  m_lastTimestamp = -1.0;
+}
+
+void CSpectrumStatistics::Stop()
+{
+  std::vector<Band>().swap(m_bands);
+}
+
+void CSpectrumStatistics::Add(double timestamp, const float* heights, int cols, float fullHeight)
+{
+  double duration = 0.0;
+  if (m_lastTimestamp >= 0.0 && timestamp > m_lastTimestamp)
+    duration = std::min(timestamp - m_lastTimestamp, kMaxRowGap);
+  m_lastTimestamp = timestamp;
+  m_seconds += duration;
+  m_rows++;
+
+  const float binsPerHeight = kBins / fullHeight;
+  cols = std::min(cols, static_cast<int>(m_bands.size()));
+  for (int i = 0; i < cols; i++)
+  {
+    Band& band = m_bands[i];
+    const float height = heights[i];
+    const int bin = std::min(std::max(static_cast<int>(height * binsPerHeight), 0), kBins - 1);
+
+    band.rows++;
+    band.sum += height;
+    band.max = std::max(band.max, height);
+    band.histogram[bin]++;
+    if (height >= fullHeight)
+      band.clipped++;
+    if (height <= 0.0f)
+    {
+      band.zero++;
+      band.zeroSeconds += duration;
+    }
+  }
+}
+
+bool CSpectrumStatistics::Write(const std::string& path) const
+{
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+
+  fprintf(file, "band,rows,mean,max,clip_rate,zero_rate,zero_seconds");
+  for (int bin = 0; bin < kBins; bin++)
+    fprintf(file, ",bin%d", bin);
+  fprintf(file, "\n");
+
+  // Columns a grid of this session never had are left out
+  for (size_t i = 0; i < m_bands.size(); i++)
+  {
+    const Band& band = m_bands[i];
+    if (!band.rows)
+      continue;
+
+    const double rows = static_cast<double>(band.rows);
+    fprintf(file, "%zu,%llu,%.6f,%.6f,%.6f,%.6f,%.3f", i, static_cast<unsigned long long>(band.rows),
+            band.sum / rows, band.max, band.clipped / rows, band.zero / rows, band.zeroSeconds);
+    for (int bin = 0; bin < kBins; bin++)
+      fprintf(file, ",%u", band.histogram[bin]);
+    fprintf(file, "\n");
+  }
+
+  return fclose(file) == 0;
+}
+
+StatisticsSummary CSpectrumStatistics::Summary() const
+{
+  double sum = 0.0;
+  uint64_t clipped = 0;
+  uint64_t zero = 0;
+  uint64_t bandRows = 0;
+  for (const Band& band : m_bands)
+  {
+    sum += band.sum;
+    clipped += band.clipped;
+    zero += band.zero;
+    bandRows += band.rows;
+  }
+
+  StatisticsSummary summary;
+  summary.rows = m_rows;
+  summary.seconds = m_seconds;
+  if (bandRows)
+  {
+    summary.meanHeight = sum / bandRows;
+    summary.clipRate = static_cast<double>(clipped) / bandRows;
+    summary.zeroRate = static_cast<double>(zero) / bandRows;
+  }
+  return summary;
+}
@@ -0,0 +1,78 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Statistics over a session of the bar heights shown, per grid column, to
+// tune presets against what was really displayed. Every row is
+// folded in with a constant amount of work per band into arrays sized in
+// Start(), the engine skips it entirely while disabled.
+//
+// Write() stores one CSV line per column, channels side by side as on
+// screen, with
+//   band          column index
+//   rows          rows seen
+//   mean, max     of the height
+//   clip_rate     share of rows at full height, the bar height setting
+//                 (0.5, 1, 2 or 3) the row was scaled with, or more
+//   zero_rate     share of rows at zero height
+//   zero_seconds  stream time spent at zero height
+//   bin0..bin15   rows with a height in [i / 16, (i + 1) / 16) of full
+//                 height, the last bin includes full height
+
+// Totals over all bands, for logging
+struct StatisticsSummary
+{
+  uint64_t rows = 0;
+  double seconds = 0.0;
+  double meanHeight = 0.0;
+  double clipRate = 0.0;
+  double zeroRate = 0.0;
+};
+
+class CSpectrumStatistics
+{
+public:
+  static constexpr int kBins = 16;
+
+  // Allocate and clear the per band arrays for rows of up to maxCols
+  void Start(int maxCols);
+  // Free them again
+  void Stop();
+  bool IsEnabled() const { return !m_bands.empty(); }
+
+  // One row as shown, fullHeight is the height of a full bar
+  void Add(double timestamp, const float* heights, int cols, float fullHeight);
+
+  bool Write(const std::string& path) const;
+
+  StatisticsSummary Summary() const;
+
+  size_t MemoryUsage() const { return m_bands.capacity() * sizeof(Band); }
+
+private:
+  struct Band
+  {
+    uint64_t rows;
+    uint64_t clipped;
+    uint64_t zero;
+    double sum;
+    double zeroSeconds;
+    float max;
+    uint32_t histogram[kBins];
+  };
+
+  std::vector<Band> m_bands;
+  uint64_t m_rows = 0;
+  double m_seconds = 0.0;
+  double m_lastTimestamp = -1.0;
+};
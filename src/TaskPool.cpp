@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "TaskPool.h"
+
+void CTaskPool::Start(int threads)
+{
+  Stop();
+
+  m_stop = false;
+  for (int i = 0; i < threads; i++)
+    m_threads.emplace_back(&CTaskPool::Process, this, m_generation);
+}
+
+void CTaskPool::Stop()
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_all();
+
+  for (std::thread& thread : m_threads)
+    thread.join();
+  m_threads.clear();
+}
+
+void CTaskPool::Run(size_t count, const std::function<void(size_t)>& func)
+{
+  if (m_threads.empty() || count < 2)
+  {
+    for (size_t i = 0; i < count; i++)
+      func(i);
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_func = &func;
+    m_count = count;
+    m_next = 0;
+    m_busy = int(m_threads.size());
+    m_generation++;
+  }
+  m_cond.notify_all();
+
+  Work();
+
+  // The loop must not return while a pool thread still uses func
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_doneCond.wait(lock, [this] { return m_busy == 0; });
+  m_func = nullptr;
+}
+
+void CTaskPool::Work()
+{
+  for (size_t i = m_next++; i < m_count; i = m_next++)
+    (*m_func)(i);
+}
+
+void CTaskPool::Process(unsigned int generation)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true)
+  {
+    m_cond.wait(lock, [&] { return m_stop || m_generation != generation; });
+    if (m_stop)
+      break;
+
+    generation = m_generation;
+    lock.unlock();
+    Work();
+    lock.lock();
+
+    if (--m_busy == 0)
+      m_doneCond.notify_all();
+  }
+}
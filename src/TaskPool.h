@@ -0,0 +1,47 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small fixed pool of threads for data parallel loops
+class CTaskPool
+{
+public:
+  ~CTaskPool() { Stop(); }
+
+  void Start(int threads);
+  void Stop();
+  int Threads() const { return int(m_threads.size()); }
+
+  // Call func(i) for every i in [0, count) and return once all calls are
+  // done. The calling thread takes part, without pool threads everything
+  // runs inline.
+  void Run(size_t count, const std::function<void(size_t)>& func);
+
+private:
+  void Process(unsigned int generation);
+  void Work();
+
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::condition_variable m_doneCond;
+  bool m_stop = false;
+  unsigned int m_generation = 0;
+  int m_busy = 0;
+
+  const std::function<void(size_t)>* m_func = nullptr;
+  size_t m_count = 0;
+  std::atomic<size_t> m_next{0};
+};
@@ -0,0 +1,52 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdint.h>
+#include <string.h>
+
+// Per vertex bar heights as streamed to the vertex shader: the height of
+// every bar repeated for each of its vertices, as 32 bit or half floats.
+// Kept apart from the renderer so the replay tool can benchmark it.
+
+// IEEE 754 half float of a non-negative height, values too small for a
+// normal half become 0 and values too large the largest half
+inline uint16_t ToHalf(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  const int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+  if (exponent <= 0 || (bits & 0x80000000))
+    return 0;
+  if (exponent >= 31)
+    return 0x7bff;
+
+  // Round to nearest
+  const uint32_t half = (uint32_t(exponent) << 10) | ((bits >> 13) & 0x3ff);
+  return static_cast<uint16_t>(std::min(half + ((bits >> 12) & 1), 0x7bffu));
+}
+
+template<typename T>
+T PackHeight(float value);
+
+template<>
+inline float PackHeight<float>(float value) { return value; }
+
+template<>
+inline uint16_t PackHeight<uint16_t>(float value) { return ToHalf(value); }
+
+// Heights of the bars [first, last), out holds Vertices entries per bar
+template<int Vertices, typename T>
+void ExpandHeights(T* out, const float* heights, size_t first, size_t last)
+{
+  for (size_t bar = first; bar < last; bar++)
+    std::fill_n(&out[bar * Vertices], Vertices, PackHeight<T>(heights[bar]));
+}
@@ -17,15 +17,23 @@
  *  Also added 'm_hSpeed' to animate transition between bar heights
  */
 
+#include "SpectrumEngine.h"
+#include "VertexHeights.h"
+
+#include <algorithm>
+#include <kodi/Filesystem.h>
 #include <kodi/addon-instance/Visualization.h>
 #include <math.h>
 #include <d3d11_1.h>
 #include <DirectXMath.h>
 #include <DirectXPackedVector.h>
 #include <stdio.h>
+#include <time.h>
+#include <vector>
 
 #define NUM_BANDS 16
-#define NUM_VERTICIES 36
+#define NUM_ROWS 16
+#define NUM_VERTICIES 36 // per bar
 
 using namespace DirectX;
 using namespace DirectX::PackedVector;
@@ -33,6 +41,7 @@ using namespace DirectX::PackedVector;
 // Include the precompiled shader code.
 namespace
 {
+  #include "CompactVertexShader.inc"
   #include "DefaultPixelShader.inc"
   #include "DefaultVertexShader.inc"
 }
@@ -43,6 +52,16 @@ typedef struct
   XMFLOAT4 col;
 } Vertex_t;
 
+// Used where the device can fetch normalized bytes, as on OpenGL: column,
+// row and corner bits x | y << 1 | z << 2 of the vertex and the shaded bar
+// color, built once per grid. The heights follow in a stream of their own,
+// as half floats where the device can fetch them.
+typedef struct
+{
+  XMUBYTE4 grid;
+  XMUBYTEN4 col;
+} GridVertex_t;
+
 typedef struct
 {
   XMFLOAT4X4 view;
@@ -54,6 +73,64 @@ typedef struct
   XMFLOAT4X4 world;
 } cbWorld;
 
+typedef struct
+{
+  XMFLOAT4 grid; // bar spacing, bar width, last row, columns
+  XMFLOAT4 intensity; // x only
+} cbGrid;
+
+namespace
+{
+
+// One face of a bar as two opposite corners in units of the bar size, the
+// y components select between the bottom (0) and the top (1) of the bar,
+// and the shading applied to the bar color
+struct BarFace
+{
+  float x1, y1, z1;
+  float x2, y2, z2;
+  float shade;
+};
+
+// Solid and wireframe bars draw all faces, the rasterizer state makes the
+// difference
+struct SolidKernel
+{
+  static constexpr int kFaces = 6;
+  static constexpr D3D11_PRIMITIVE_TOPOLOGY kTopology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+  static constexpr BarFace kFaceTable[kFaces] =
+  {
+    { 0, 1, 0, 1, 1, 1, 1.0f }, // top
+    { 0, 0, 0, 1, 0, 1, 1.0f }, // bottom
+    { 0, 0, 1, 1, 1, 1, 0.5f }, // front
+    { 0, 0, 0, 1, 1, 0, 0.5f }, // back
+    { 0, 0, 0, 0, 1, 1, 0.25f }, // left
+    { 1, 0, 0, 1, 1, 1, 0.25f }, // right
+  };
+
+  static XMFLOAT4 Color(float red, float green, float blue, float shade)
+  {
+    return XMFLOAT4(shade * red, shade * green, shade * blue, 1.0f);
+  }
+};
+
+// Points of the faces not hidden by the others are enough
+struct PointKernel
+{
+  static constexpr int kFaces = 3;
+  static constexpr D3D11_PRIMITIVE_TOPOLOGY kTopology = D3D11_PRIMITIVE_TOPOLOGY_POINTLIST;
+  static constexpr BarFace kFaceTable[kFaces] =
+  {
+    { 0, 0, 0, 1, 0, 1, 1.0f }, // bottom
+    { 0, 0, 0, 1, 1, 0, 1.0f }, // back
+    { 1, 0, 0, 1, 1, 1, 1.0f }, // right
+  };
+
+  static XMFLOAT4 Color(float, float, float, float) { return XMFLOAT4(0.2f, 1.0f, 0.2f, 1.0f); }
+};
+
+} // namespace
+
 #define VERTEX_FORMAT (D3DFVF_XYZ | D3DFVF_DIFFUSE)
 
 class CVisualizationSpectrum
@@ -65,26 +142,80 @@ public:
   ~CVisualizationSpectrum() override;
 
   bool Start(int channels, int samplesPerSec, int bitsPerSample, const std::string& songName) override;
+  void Stop() override;
   void Render() override;
   void AudioData(const float* audioData, size_t audioDataLength) override;
+  void GetInfo(bool& wantsFreq, int& syncDelay) override;
   ADDON_STATUS SetSetting(const std::string& settingName, const kodi::addon::CSettingValue& settingValue) override;
 
 private:
-  void SetBarHeightSetting(int settingValue);
-  void SetSpeedSetting(int settingValue);
+  void ApplySettings(const SpectrumSettings& settings);
   void SetModeSetting(int settingValue);
+  void StartCapture();
+  void WriteStatistics();
+
+  // Settings in effect and changes waiting for the next frame boundary
+  SpectrumSettings m_settings;
+  CSettingsQueue m_pendingSettings;
+
+  // Per-bar offsets and base colors which stay the same between frames,
+  // rebuilt only when the grid size changes. Stored as structure of arrays
+  // in row-major bar order.
+  struct BarLayout
+  {
+    ArenaVector<float> xOffset;
+    ArenaVector<float> zOffset;
+    ArenaVector<float> red;
+    ArenaVector<float> green;
+    ArenaVector<float> blue;
+  };
+
+  void BuildLayout();
 
-  float heights[16][16], cHeights[16][16], m_scale;
+  // With SPECTRUM_STATIC_ALLOCATION all analysis and render buffers are
+  // carved from m_arena in Start(), sized for the largest grid the settings
+  // allow, so nothing is allocated while visualizing
+  void ReserveBuffers(int channels, int samplesPerSec);
+  void ReportMemory(CMemoryReport& report);
+  void LogMemory();
+  CArena m_arena;
+
+  BarLayout m_layout;
+  int m_gridRows = NUM_ROWS;
+  int m_gridCols = NUM_BANDS;
+  float m_barWidth = 0.1f;
+
+  CSpectrumEngine m_engine;
   DWORD m_mode; // D3DFILL_SOLID;
   float m_y_angle, m_y_speed, m_y_fixedAngle;
   float m_x_angle, m_x_speed;
   float m_z_angle, m_z_speed;
-  float m_hSpeed;
+
+  // 0 off, 1 spin faster, 2 brighter colors, 3 camera shake on beats
+  int m_beatEffect = 0;
+  float m_intensity = 1.0f;
+  double m_startTime = 0.0;
 
   void draw_vertex(Vertex_t * pVertex, float x, float y, float z, XMFLOAT4 color);
   int draw_rectangle(Vertex_t * verts, float x1, float y1, float z1, float x2, float y2, float z2, XMFLOAT4 color);
-  void draw_bar(float x_offset, float z_offset, float height, float red, float green, float blue);
+  int grid_rectangle(GridVertex_t * verts, int col, int row, const BarFace& face, XMUBYTEN4 color);
+
+  // Geometry kernel per fill mode, chosen by SetModeSetting(). Faces and
+  // vertex count per bar are compile-time constants of each kernel, so the
+  // per-bar loop has no mode checks.
+  template<class Kernel>
   void draw_bars(void);
+  template<class Kernel, typename T>
+  void draw_compact_bars(void);
+  template<class Kernel>
+  void BuildGridGeometry();
+  void SelectDrawBars();
+  void (CVisualizationSpectrum::*m_drawBars)(void);
+  bool m_compactVertices = false;
+  DXGI_FORMAT m_heightFormat = DXGI_FORMAT_R32_FLOAT;
+  UINT HeightSize() const { return m_heightFormat == DXGI_FORMAT_R16_FLOAT ? sizeof(uint16_t) : sizeof(float); }
+  ArenaVector<GridVertex_t> m_gridVertices;
+  bool m_gridGeometryValid = false;
   bool init_renderer_objs();
 
   ID3D11Device* m_device = nullptr;
@@ -92,9 +223,12 @@ private:
   ID3D11VertexShader* m_vShader = nullptr;
   ID3D11PixelShader* m_pShader = nullptr;
   ID3D11InputLayout* m_inputLayout = nullptr;
-  ID3D11Buffer* m_vBuffer = nullptr;
+  ID3D11Buffer* m_vBuffer = nullptr; // vertices, or only the heights with compact vertices
+  int m_vBufferBars = 0;
+  ID3D11Buffer* m_gridBuffer = nullptr;
   ID3D11Buffer* m_cViewProj = nullptr;
   ID3D11Buffer* m_cWorld = nullptr;
+  ID3D11Buffer* m_cGrid = nullptr;
   ID3D11RasterizerState* m_rsStateSolid = nullptr;
   ID3D11RasterizerState* m_rsStateWire = nullptr;
   ID3D11BlendState* m_omBlend = nullptr;
@@ -106,22 +240,22 @@ private:
 // !!! Add-on master function !!!
 //-----------------------------------------------------------------------------
 CVisualizationSpectrum::CVisualizationSpectrum()
-  : m_mode(3),
+  : m_engine(NUM_ROWS, NUM_BANDS),
+    m_mode(3),
     m_y_angle(45.0f),
     m_y_speed(0.5f),
     m_x_angle(20.0f),
     m_x_speed(0.0f),
     m_z_angle(0.0f),
     m_z_speed(0.0f),
-    m_hSpeed(0.05f)
+    m_drawBars(&CVisualizationSpectrum::draw_bars<SolidKernel>)
 {
   m_context = (ID3D11DeviceContext*)Device();
   m_context->GetDevice(&m_device);
 
-  SetBarHeightSetting(kodi::addon::GetSettingInt("bar_height"));
-  SetSpeedSetting(kodi::addon::GetSettingInt("speed"));
-  SetModeSetting(kodi::addon::GetSettingInt("mode"));
-  m_y_fixedAngle = kodi::addon::GetSettingInt("rotation_angle");
+  m_settings.ForEach([](const char* name, int& value) { value = kodi::addon::GetSettingInt(name); });
+  m_pendingSettings.Reset(m_settings);
+  ApplySettings(m_settings);
 
   if (!init_renderer_objs())
     kodi::Log(ADDON_LOG_ERROR, "Failed to init DirectX");
@@ -137,6 +271,8 @@ CVisualizationSpectrum::~CVisualizationSpectrum()
     m_cViewProj->Release();
   if (m_cWorld)
     m_cWorld->Release();
+  if (m_cGrid)
+    m_cGrid->Release();
   if (m_rsStateSolid)
     m_rsStateSolid->Release();
   if (m_rsStateWire)
@@ -147,6 +283,8 @@ CVisualizationSpectrum::~CVisualizationSpectrum()
     m_omDepth->Release();
   if (m_vBuffer)
     m_vBuffer->Release();
+  if (m_gridBuffer)
+    m_gridBuffer->Release();
   if (m_inputLayout)
     m_inputLayout->Release();
   if (m_vShader)
@@ -164,6 +302,11 @@ void CVisualizationSpectrum::Render()
 {
   bool configured = true; //FALSE;
 
+  // Apply all setting changes made since the last frame at once
+  SpectrumSettings settings;
+  if (m_pendingSettings.Take(settings))
+    ApplySettings(settings);
+
   float factors[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
   m_context->OMSetBlendState(m_omBlend, factors, 0xFFFFFFFF);
   m_context->OMSetDepthStencilState(m_omDepth, 0);
@@ -178,8 +321,6 @@ void CVisualizationSpectrum::Render()
     break;
   }
 
-  unsigned stride = sizeof(Vertex_t), offset = 0;
-  m_context->IASetVertexBuffers(0, 1, &m_vBuffer, &stride, &offset);
   m_context->IASetInputLayout(m_inputLayout);
   m_context->VSSetShader(m_vShader, 0, 0);
   m_context->VSSetConstantBuffers(0, 1, &m_cViewProj);
@@ -188,13 +329,28 @@ void CVisualizationSpectrum::Render()
 
   if(configured)
   {
+    // Animation step runs as its own pass over the whole grid, geometry
+    // only consumes the result
+    m_engine.Animate();
+    if (m_engine.Bars().Cols() != m_gridCols)
+    {
+      m_gridCols = m_engine.Bars().Cols();
+      BuildLayout();
+    }
+
+    // Beats speed up the rotation, brighten the bars or shake the camera
+    const float pulse = m_engine.BeatPulse();
+    const float spin = m_beatEffect == 1 ? 1.0f + 4.0f * pulse : 1.0f;
+    const float shake = m_beatEffect == 3 ? 0.05f * pulse : 0.0f;
+    m_intensity = m_beatEffect == 2 ? 1.0f + 0.6f * pulse : 1.0f;
+
     m_x_angle += m_x_speed;
     if (m_x_angle >= 360.0f)
       m_x_angle -= 360.0f;
 
     if (m_y_fixedAngle < 0.0f)
     {
-      m_y_angle += m_y_speed;
+      m_y_angle += m_y_speed * spin;
       if(m_y_angle >= 360.0)
         m_y_angle -= 360.0;
     }
@@ -207,6 +363,9 @@ void CVisualizationSpectrum::Render()
     if (m_z_angle >= 360.0f)
       m_z_angle -= 360.0f;
 
+    // The shake runs on the stream clock, so it also shakes at a fixed angle
+    const float time = static_cast<float>(m_engine.Now() - m_startTime);
+
     D3D11_MAPPED_SUBRESOURCE res;
     if (S_OK == m_context->Map(m_cWorld, 0, D3D11_MAP_WRITE_DISCARD, 0, &res))
     {
@@ -215,32 +374,43 @@ void CVisualizationSpectrum::Render()
         matRotationX = XMMatrixRotationX(-XMConvertToRadians(m_x_angle)),
         matRotationY = XMMatrixRotationY(-XMConvertToRadians(m_y_angle)),
         matRotationZ = XMMatrixRotationZ(XMConvertToRadians(m_z_angle)),
-        matTranslation = XMMatrixTranslation(0.0f, -0.5f, 5.0f),
+        matTranslation = XMMatrixTranslation(shake * sinf(time * 47.0f),
+                                             -0.5f + shake * cosf(time * 61.0f), 5.0f),
         matWorld = matRotationZ * matRotationY * matRotationX * matTranslation;
       XMStoreFloat4x4(&cWorld->world, XMMatrixTranspose(matWorld));
 
       m_context->Unmap(m_cWorld, 0);
     }
 
-    draw_bars();
+    (this->*m_drawBars)();
   }
 }
 
 bool CVisualizationSpectrum::Start(int iChannels, int iSamplesPerSec, int iBitsPerSample, const std::string& songName)
 {
-  int x, y;
-
-  for(x = 0; x < 16; x++)
+  if (kodi::addon::GetSettingBoolean("capture"))
+    StartCapture();
+  if (kodi::addon::GetSettingBoolean("statistics"))
+    m_engine.StartStatistics(iChannels);
+
+#ifdef SPECTRUM_STATIC_ALLOCATION
+  // Measure the buffers for the largest configuration first, then carve
+  // them from one block of that size
+  m_arena.BeginMeasure();
+  ReserveBuffers(iChannels, iSamplesPerSec);
+  m_arena.Commit();
+  ReserveBuffers(iChannels, iSamplesPerSec);
+#endif
+
+  m_engine.Start(iChannels, iSamplesPerSec, iBitsPerSample, songName);
+  m_startTime = m_engine.Now();
+
+  if (m_engine.IsCapturing())
   {
-    for(y = 0; y < 16; y++)
-    {
-      heights[y][x] = 0.0f;
-      cHeights[y][x] = 0.0f;
-    }
+    // Settings snapshot so a replay starts from the same state
+    m_settings.ForEach([this](const char* name, int& value) { m_engine.RecordSetting(name, value); });
   }
 
-  m_scale = 1.0f / log(256.0f);
-
   m_x_speed = 0.0f;
   m_y_speed = 0.5f;
   m_z_speed = 0.0f;
@@ -248,98 +418,46 @@ bool CVisualizationSpectrum::Start(int iChannels, int iSamplesPerSec, int iBitsP
   m_y_angle = 45.0f;
   m_z_angle = 0.0f;
 
+  BuildLayout();
+
   return true;
 }
 
-void CVisualizationSpectrum::AudioData(const float* pAudioData, size_t audioDataLength)
+void CVisualizationSpectrum::Stop()
 {
-  int i,c;
-  int y=0;
-  float val;
-
-  int xscale[] = {0, 1, 2, 3, 5, 7, 10, 14, 20, 28, 40, 54, 74, 101, 137, 187, 255};
-
-  for(y = 15; y > 0; y--)
-  {
-    for(i = 0; i < 16; i++)
-    {
-      heights[y][i] = heights[y - 1][i];
-    }
-  }
-
-  for(i = 0; i < NUM_BANDS; i++)
-  {
-    for(c = xscale[i], y = 0; c < xscale[i + 1]; c++)
-    {
-      if (c < audioDataLength)
-      {
-        if((int)(pAudioData[c] * (0x07fff+.5f) > y))
-          y = (int)(pAudioData[c] * (0x07fff+.5f));
-      }
-      else
-        continue;
-    }
-    y >>= 7;
-    if(y > 0)
-      val = (logf((float)y) * m_scale);
-    else
-      val = 0;
-    heights[0][i] = val;
-  }
+  // Kodi's audio thread may still be in AudioData(), the rows it adds
+  // until StopOutputs() are not in the statistics file
+  if (m_engine.IsCollectingStatistics())
+    WriteStatistics();
+  m_engine.StopOutputs();
+  if (m_engine.EarlyRows())
+    kodi::Log(ADDON_LOG_WARNING, "Output delay not fully compensated, %llu rows shown early with a full row queue",
+              static_cast<unsigned long long>(m_engine.EarlyRows()));
+  LogMemory();
 }
 
-void CVisualizationSpectrum::SetBarHeightSetting(int settingValue)
+void CVisualizationSpectrum::AudioData(const float* pAudioData, size_t audioDataLength)
 {
-  switch (settingValue)
-  {
-  case 1://standard
-    m_scale = 1.f / log(256.f);
-    break;
-
-  case 2://big
-    m_scale = 2.f / log(256.f);
-    break;
-
-  case 3://real big
-    m_scale = 3.f / log(256.f);
-    break;
-
-  case 4://unused
-    m_scale = 0.33f / log(256.f);
-    break;
-
-  case 0://small
-  default:
-    m_scale = 0.5f / log(256.f);
-    break;
-  }
+  m_engine.AudioData(pAudioData, audioDataLength);
 }
 
-void CVisualizationSpectrum::SetSpeedSetting(int settingValue)
+void CVisualizationSpectrum::GetInfo(bool& wantsFreq, int& syncDelay)
 {
-  switch (settingValue)
-  {
-  case 1:
-    m_hSpeed = 0.025f;
-    break;
-
-  case 2:
-    m_hSpeed = 0.0125f;
-    break;
-
-  case 3:
-    m_hSpeed = 0.1f;
-    break;
-
-  case 4:
-    m_hSpeed = 0.2f;
-    break;
+  // Kodi holds back this many buffers before passing them on, covering the
+  // configured output delay as far as our own latency doesn't already
+  wantsFreq = false;
+  syncDelay = m_engine.SyncDelay();
+  kodi::Log(ADDON_LOG_DEBUG, "Visualization latency %.1f ms, holding back %d audio buffers",
+            m_engine.Latency() * 1000.0, syncDelay);
+}
 
-  case 0:
-  default:
-    m_hSpeed = 0.05f;
-    break;
-  }
+void CVisualizationSpectrum::ApplySettings(const SpectrumSettings& settings)
+{
+  m_settings = settings;
+  m_engine.ApplySettings(settings);
+  SetModeSetting(settings.mode);
+  m_y_fixedAngle = settings.rotationAngle;
+  m_beatEffect = settings.beatEffect;
 }
 
 void CVisualizationSpectrum::SetModeSetting(int settingValue)
@@ -359,6 +477,69 @@ void CVisualizationSpectrum::SetModeSetting(int settingValue)
     m_mode = 3; // D3DFILL_SOLID;
     break;
   }
+
+  SelectDrawBars();
+}
+
+void CVisualizationSpectrum::SelectDrawBars()
+{
+  const bool halfHeights = m_heightFormat == DXGI_FORMAT_R16_FLOAT;
+  if (m_mode == 1 /*D3DFILL_POINT*/)
+  {
+    if (!m_compactVertices)
+      m_drawBars = &CVisualizationSpectrum::draw_bars<PointKernel>;
+    else
+      m_drawBars = halfHeights ? &CVisualizationSpectrum::draw_compact_bars<PointKernel, uint16_t>
+                               : &CVisualizationSpectrum::draw_compact_bars<PointKernel, float>;
+  }
+  else
+  {
+    if (!m_compactVertices)
+      m_drawBars = &CVisualizationSpectrum::draw_bars<SolidKernel>;
+    else
+      m_drawBars = halfHeights ? &CVisualizationSpectrum::draw_compact_bars<SolidKernel, uint16_t>
+                               : &CVisualizationSpectrum::draw_compact_bars<SolidKernel, float>;
+  }
+
+  // The grid vertices depend on the kernel's faces
+  m_gridGeometryValid = false;
+}
+
+void CVisualizationSpectrum::StartCapture()
+{
+  const std::string dir = kodi::addon::GetUserPath();
+  if (!kodi::vfs::DirectoryExists(dir))
+    kodi::vfs::CreateDirectory(dir);
+
+  char name[64];
+  const time_t now = time(nullptr);
+  strftime(name, sizeof(name), "capture-%Y%m%d-%H%M%S.spcp", localtime(&now));
+
+  const std::string path = kodi::addon::GetUserPath(name);
+  if (m_engine.StartCapture(path))
+    kodi::Log(ADDON_LOG_INFO, "Recording session to %s", path.c_str());
+  else
+    kodi::Log(ADDON_LOG_ERROR, "Failed to open capture file %s", path.c_str());
+}
+
+void CVisualizationSpectrum::WriteStatistics()
+{
+  const std::string dir = kodi::addon::GetUserPath();
+  if (!kodi::vfs::DirectoryExists(dir))
+    kodi::vfs::CreateDirectory(dir);
+
+  char name[64];
+  const time_t now = time(nullptr);
+  strftime(name, sizeof(name), "statistics-%Y%m%d-%H%M%S.csv", localtime(&now));
+
+  const std::string path = kodi::addon::GetUserPath(name);
+  StatisticsSummary summary;
+  if (m_engine.WriteStatistics(path, summary))
+    kodi::Log(ADDON_LOG_INFO, "Statistics of %llu rows written to %s: mean height %.3f, %.1f%% at full height, %.1f%% at zero",
+              static_cast<unsigned long long>(summary.rows), path.c_str(), summary.meanHeight,
+              summary.clipRate * 100.0, summary.zeroRate * 100.0);
+  else
+    kodi::Log(ADDON_LOG_ERROR, "Failed to write statistics file %s", path.c_str());
 }
 
 //-- SetSetting ---------------------------------------------------------------
@@ -370,26 +551,19 @@ ADDON_STATUS CVisualizationSpectrum::SetSetting(const std::string& settingName,
   if (settingName.empty() || settingValue.empty())
     return ADDON_STATUS_UNKNOWN;
 
-  if (settingName == "bar_height")
+  if (IsOutputSetting(settingName))
   {
-    SetBarHeightSetting(settingValue.GetInt());
+    kodi::Log(ADDON_LOG_DEBUG, "Setting %s %s, takes effect with the next song", settingName.c_str(),
+              settingValue.GetBoolean() ? "on" : "off");
     return ADDON_STATUS_OK;
   }
-  else if (settingName == "speed")
-  {
-    SetSpeedSetting(settingValue.GetInt());
-    return ADDON_STATUS_OK;
-  }
-  else if (settingName == "mode")
-  {
-    SetModeSetting(settingValue.GetInt());
-    return ADDON_STATUS_OK;
-  }
-  else if (settingName == "rotation_angle")
-  {
-    m_y_fixedAngle = settingValue.GetInt();
+
+  m_engine.RecordSetting(settingName, settingValue.GetInt());
+
+  // Only recorded here, Render() applies all changes made since the last
+  // frame at once
+  if (m_pendingSettings.Set(settingName, settingValue.GetInt()))
     return ADDON_STATUS_OK;
-  }
 
   return ADDON_STATUS_UNKNOWN;
 }
@@ -425,104 +599,270 @@ int CVisualizationSpectrum::draw_rectangle(Vertex_t * verts, float x1, float y1,
   return 6;
 }
 
-void CVisualizationSpectrum::draw_bar(float x_offset, float z_offset, float height, float red, float green, float blue)
+// The same corners as draw_rectangle(), as the column and row of the bar
+// and the corner bits x | y << 1 | z << 2 the vertex shader builds the
+// position from
+int CVisualizationSpectrum::grid_rectangle(GridVertex_t * verts, int col, int row, const BarFace& face, XMUBYTEN4 color)
 {
-  Vertex_t  verts[NUM_VERTICIES];
-  int verts_idx = 0;
-
-  float width = 0.1f;
-  XMFLOAT4 color;
-
-  if (1 == m_mode /*== D3DFILL_POINT*/)
-    color = XMFLOAT4(0.2f, 1.0f, 0.2f, 1.0f);
-
-  if (1 != m_mode /*!= D3DFILL_POINT*/)
+  const int x1 = int(face.x1), y1 = int(face.y1) << 1, z1 = int(face.z1) << 2;
+  const int x2 = int(face.x2), y2 = int(face.y2) << 1, z2 = int(face.z2) << 2;
+  const int corners[2][6] =
   {
-    color = XMFLOAT4(red, green, blue, 1.0f);
-    verts_idx += draw_rectangle(&verts[verts_idx], x_offset, height, z_offset, x_offset + width, height, z_offset + 0.1f, color);
-  }
-  verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset, x_offset + width, 0.0f, z_offset + 0.1f, color);
+    { x1 | y1 | z1, x2 | y1 | z1, x2 | y2 | z2, x2 | y2 | z2, x1 | y2 | z2, x1 | y1 | z1 },
+    { x1 | y1 | z1, x2 | y1 | z2, x2 | y2 | z2, x2 | y2 | z2, x1 | y2 | z1, x1 | y1 | z1 },
+  };
+  const int* corner = corners[y1 == y2 ? 0 : 1];
 
-  if (1 != m_mode /*!= D3DFILL_POINT*/)
+  for (int i = 0; i < 6; i++)
   {
-    color = XMFLOAT4(0.5f * red, 0.5f * green, 0.5f * blue, 1.0f);
-    verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset + 0.1f, x_offset + width, height, z_offset + 0.1f, color);
+    verts[i].grid = XMUBYTE4(uint8_t(col), uint8_t(row), uint8_t(corner[i]), uint8_t(0));
+    verts[i].col = color;
   }
-  verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset, x_offset + width, height, z_offset, color);
+  return 6;
+}
 
-  if (1 != m_mode /*!= D3DFILL_POINT*/)
+void CVisualizationSpectrum::BuildLayout()
+{
+  const int bars = m_gridRows * m_gridCols;
+  const float spacing = 3.2f / m_gridCols;
+
+  m_layout.xOffset.resize(bars);
+  m_layout.zOffset.resize(bars);
+  m_layout.red.resize(bars);
+  m_layout.green.resize(bars);
+  m_layout.blue.resize(bars);
+
+  for (int y = 0; y < m_gridRows; y++)
   {
-    color = XMFLOAT4(0.25f * red, 0.25f * green, 0.25f * blue, 1.0f);
-    verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset , x_offset, height, z_offset + 0.1f, color);
+    const float z_offset = -1.6f + (m_gridRows - 1 - y) * spacing;
+    const float b_base = float(y) / (m_gridRows - 1);
+    const float r_base = 1.0f - b_base;
+
+    for (int x = 0; x < m_gridCols; x++)
+    {
+      const int bar = y * m_gridCols + x;
+      m_layout.xOffset[bar] = -1.6f + float(x) * spacing;
+      m_layout.zOffset[bar] = z_offset;
+      m_layout.red[bar] = r_base - float(x) * (r_base / (m_gridCols - 1));
+      m_layout.green[bar] = float(x) / (m_gridCols - 1);
+      m_layout.blue[bar] = b_base;
+    }
   }
-  verts_idx += draw_rectangle(&verts[verts_idx], x_offset + width, 0.0f, z_offset , x_offset + width, height, z_offset + 0.1f, color);
 
-  D3D11_MAPPED_SUBRESOURCE res;
-  if (S_OK == m_context->Map(m_vBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &res))
+  m_barWidth = spacing * 0.5f;
+  m_gridGeometryValid = false;
+
+  if (m_vBufferBars != bars)
   {
-    memcpy(res.pData, verts, sizeof(Vertex_t) * NUM_VERTICIES);
-    m_context->Unmap(m_vBuffer, 0);
+    if (m_vBuffer)
+      m_vBuffer->Release();
+    m_vBuffer = nullptr;
+    m_vBufferBars = 0;
+
+    const UINT vertexSize = m_compactVertices ? HeightSize() : sizeof(Vertex_t);
+    CD3D11_BUFFER_DESC desc(vertexSize * NUM_VERTICIES * bars, D3D11_BIND_VERTEX_BUFFER, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
+    if (S_OK == m_device->CreateBuffer(&desc, NULL, &m_vBuffer))
+      m_vBufferBars = bars;
   }
+}
+
+void CVisualizationSpectrum::ReserveBuffers(int channels, int samplesPerSec)
+{
+  m_engine.ReserveBuffers(m_arena, channels, samplesPerSec);
+
+  const size_t bars = size_t(NUM_ROWS) * m_engine.MaxCols(channels);
+  ReserveBuffer(m_layout.xOffset, m_arena, bars);
+  ReserveBuffer(m_layout.zOffset, m_arena, bars);
+  ReserveBuffer(m_layout.red, m_arena, bars);
+  ReserveBuffer(m_layout.green, m_arena, bars);
+  ReserveBuffer(m_layout.blue, m_arena, bars);
+  if (m_compactVertices)
+    ReserveBuffer(m_gridVertices, m_arena, bars * NUM_VERTICIES);
+}
 
-  m_context->IASetPrimitiveTopology(m_mode != 1 /*D3DFILL_POINT*/ ? D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST : D3D11_PRIMITIVE_TOPOLOGY_POINTLIST);
-  m_context->Draw(verts_idx, 0);
+void CVisualizationSpectrum::ReportMemory(CMemoryReport& report)
+{
+  m_engine.ReportMemory(report);
+
+  const size_t vertexSize = m_compactVertices ? sizeof(GridVertex_t) + HeightSize() : sizeof(Vertex_t);
+  report.Add("bar geometry",
+             BufferBytes(m_layout.xOffset) + BufferBytes(m_layout.zOffset) + BufferBytes(m_layout.red) +
+                 BufferBytes(m_layout.green) + BufferBytes(m_layout.blue) + BufferBytes(m_gridVertices),
+             vertexSize * NUM_VERTICIES * m_vBufferBars);
+  report.Add("constants", 0, sizeof(cbViewProj) + sizeof(cbWorld) + (m_cGrid ? sizeof(cbGrid) : 0));
+}
+
+void CVisualizationSpectrum::LogMemory()
+{
+  CMemoryReport report;
+  ReportMemory(report);
+  for (const CMemoryReport::Entry& entry : report.Entries())
+    kodi::Log(ADDON_LOG_DEBUG, "Memory of %s: %zu bytes CPU, %zu bytes GPU", entry.subsystem.c_str(),
+              entry.cpuBytes, entry.gpuBytes);
+  kodi::Log(ADDON_LOG_DEBUG, "Memory total: %zu bytes CPU, %zu bytes GPU", report.CpuBytes(), report.GpuBytes());
+#ifdef SPECTRUM_STATIC_ALLOCATION
+  kodi::Log(ADDON_LOG_DEBUG, "Memory arena: %zu of %zu bytes used", m_arena.Used(), m_arena.Capacity());
+  if (m_arena.Overflow())
+    kodi::Log(ADDON_LOG_WARNING, "Memory arena too small, %zu bytes taken from the heap", m_arena.Overflow());
+#endif
 }
 
+template<class Kernel>
 void CVisualizationSpectrum::draw_bars(void)
 {
-  int x,y;
-  float x_offset, z_offset, r_base, b_base;
+  const float* heights = m_engine.Bars().Current();
+  const int bars = std::min(int(m_engine.Bars().Count()), m_vBufferBars);
+
+  // All bars go into one buffer and one draw call
+  D3D11_MAPPED_SUBRESOURCE res;
+  if (S_OK != m_context->Map(m_vBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &res))
+    return;
 
-  for(y = 0; y < 16; y++)
+  Vertex_t* verts = static_cast<Vertex_t*>(res.pData);
+  for (int bar = 0; bar < bars; bar++)
   {
-    z_offset = -1.6f + ((15 - y) * 0.2f);
+    const float x = m_layout.xOffset[bar];
+    const float z = m_layout.zOffset[bar];
+    const float height = heights[bar];
+    const float red = std::min(m_layout.red[bar] * m_intensity, 1.0f);
+    const float green = std::min(m_layout.green[bar] * m_intensity, 1.0f);
+    const float blue = std::min(m_layout.blue[bar] * m_intensity, 1.0f);
+
+    for (int f = 0; f < Kernel::kFaces; f++)
+    {
+      const BarFace& face = Kernel::kFaceTable[f];
+      verts += draw_rectangle(verts, x + face.x1 * m_barWidth, face.y1 * height, z + face.z1 * m_barWidth,
+                              x + face.x2 * m_barWidth, face.y2 * height, z + face.z2 * m_barWidth,
+                              Kernel::Color(red, green, blue, face.shade));
+    }
+  }
+  m_context->Unmap(m_vBuffer, 0);
 
-    b_base = y * (1.0f / 15);
-    r_base = 1.0f - b_base;
+  unsigned stride = sizeof(Vertex_t), offset = 0;
+  m_context->IASetVertexBuffers(0, 1, &m_vBuffer, &stride, &offset);
+  m_context->IASetPrimitiveTopology(Kernel::kTopology);
+  m_context->Draw(bars * Kernel::kFaces * 6, 0);
+}
 
-    for(x = 0; x < 16; x++)
+template<class Kernel>
+void CVisualizationSpectrum::BuildGridGeometry()
+{
+  if (m_gridBuffer)
+    m_gridBuffer->Release();
+  m_gridBuffer = nullptr;
+
+  const int bars = std::min(m_gridRows * m_gridCols, m_vBufferBars);
+  m_gridVertices.resize(size_t(bars) * Kernel::kFaces * 6);
+
+  GridVertex_t* verts = m_gridVertices.data();
+  for (int bar = 0; bar < bars; bar++)
+  {
+    for (int f = 0; f < Kernel::kFaces; f++)
     {
-      x_offset = -1.6f + (x * 0.2f);
-      if (::fabs(cHeights[y][x]-heights[y][x])>m_hSpeed)
-      {
-        if (cHeights[y][x]<heights[y][x])
-          cHeights[y][x] += m_hSpeed;
-        else
-          cHeights[y][x] -= m_hSpeed;
-      }
-      draw_bar(x_offset, z_offset,
-               cHeights[y][x], r_base - (x * (r_base / 15.0f)),
-               x * (1.0f / 15), b_base);
+      const BarFace& face = Kernel::kFaceTable[f];
+      const XMFLOAT4 color = Kernel::Color(m_layout.red[bar], m_layout.green[bar], m_layout.blue[bar], face.shade);
+      verts += grid_rectangle(verts, bar % m_gridCols, bar / m_gridCols, face,
+                              XMUBYTEN4(color.x, color.y, color.z, color.w));
     }
   }
+
+  // Only rebuilt with the grid or the mode, the heights are streamed
+  CD3D11_BUFFER_DESC desc(UINT(sizeof(GridVertex_t) * m_gridVertices.size()), D3D11_BIND_VERTEX_BUFFER,
+                          D3D11_USAGE_IMMUTABLE);
+  D3D11_SUBRESOURCE_DATA initData = { 0 };
+  initData.pSysMem = m_gridVertices.data();
+  if (bars > 0 && S_OK != m_device->CreateBuffer(&desc, &initData, &m_gridBuffer))
+    m_gridBuffer = nullptr;
+
+  m_gridGeometryValid = true;
+}
+
+template<class Kernel, typename T>
+void CVisualizationSpectrum::draw_compact_bars(void)
+{
+  if (!m_gridGeometryValid)
+    BuildGridGeometry<Kernel>();
+  if (!m_gridBuffer)
+    return;
+
+  const int bars = std::min(int(m_engine.Bars().Count()), int(m_gridVertices.size()) / (Kernel::kFaces * 6));
+
+  // Grid spacing and the brightness of the beat effect
+  D3D11_MAPPED_SUBRESOURCE res;
+  if (S_OK == m_context->Map(m_cGrid, 0, D3D11_MAP_WRITE_DISCARD, 0, &res))
+  {
+    cbGrid* cGrid = static_cast<cbGrid*>(res.pData);
+    cGrid->grid = XMFLOAT4(m_barWidth * 2.0f, m_barWidth, float(m_gridRows - 1), float(m_gridCols));
+    cGrid->intensity = XMFLOAT4(m_intensity, 0.0f, 0.0f, 0.0f);
+    m_context->Unmap(m_cGrid, 0);
+  }
+
+  // Only the heights are written per frame, repeated for every vertex
+  if (S_OK != m_context->Map(m_vBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &res))
+    return;
+  ExpandHeights<Kernel::kFaces * 6>(static_cast<T*>(res.pData), m_engine.Bars().Current(), 0, bars);
+  m_context->Unmap(m_vBuffer, 0);
+
+  ID3D11Buffer* buffers[2] = { m_gridBuffer, m_vBuffer };
+  unsigned strides[2] = { sizeof(GridVertex_t), sizeof(T) };
+  unsigned offsets[2] = { 0, 0 };
+  m_context->IASetVertexBuffers(0, 2, buffers, strides, offsets);
+  m_context->IASetPrimitiveTopology(Kernel::kTopology);
+  m_context->VSSetConstantBuffers(2, 1, &m_cGrid);
+  m_context->Draw(bars * Kernel::kFaces * 6, 0);
 }
 
 bool CVisualizationSpectrum::init_renderer_objs()
 {
-  if (S_OK != m_device->CreateVertexShader(DefaultVertexShaderCode, sizeof(DefaultVertexShaderCode), nullptr, &m_vShader))
-    return false;
-
-  // Create input layout
+  // Compact vertices where the device can fetch normalized bytes from
+  // vertex buffers, with half float heights where it can fetch those too
+  UINT byteSupport = 0, halfSupport = 0;
+  m_compactVertices = S_OK == m_device->CheckFormatSupport(DXGI_FORMAT_R8G8B8A8_UNORM, &byteSupport) &&
+                      (byteSupport & D3D11_FORMAT_SUPPORT_IA_VERTEX_BUFFER);
+  m_heightFormat = S_OK == m_device->CheckFormatSupport(DXGI_FORMAT_R16_FLOAT, &halfSupport) &&
+                           (halfSupport & D3D11_FORMAT_SUPPORT_IA_VERTEX_BUFFER)
+                       ? DXGI_FORMAT_R16_FLOAT
+                       : DXGI_FORMAT_R32_FLOAT;
+  SelectDrawBars();
+
+  // Create vertex shader and input layout
   D3D11_INPUT_ELEMENT_DESC layout[] =
   {
     { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT,    0,  0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
     { "COLOR",    0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
   };
-  if (S_OK != m_device->CreateInputLayout(layout, ARRAYSIZE(layout), DefaultVertexShaderCode, sizeof(DefaultVertexShaderCode), &m_inputLayout))
-    return false;
+  D3D11_INPUT_ELEMENT_DESC compactLayout[] =
+  {
+    { "POSITION", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    { "COLOR",    0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 4, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    { "TEXCOORD", 0, m_heightFormat,             1, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+  };
+  if (m_compactVertices)
+  {
+    if (S_OK != m_device->CreateVertexShader(CompactVertexShaderCode, sizeof(CompactVertexShaderCode), nullptr, &m_vShader))
+      return false;
+    if (S_OK != m_device->CreateInputLayout(compactLayout, ARRAYSIZE(compactLayout), CompactVertexShaderCode, sizeof(CompactVertexShaderCode), &m_inputLayout))
+      return false;
+  }
+  else
+  {
+    if (S_OK != m_device->CreateVertexShader(DefaultVertexShaderCode, sizeof(DefaultVertexShaderCode), nullptr, &m_vShader))
+      return false;
+    if (S_OK != m_device->CreateInputLayout(layout, ARRAYSIZE(layout), DefaultVertexShaderCode, sizeof(DefaultVertexShaderCode), &m_inputLayout))
+      return false;
+  }
 
   // Create pixel shader
   if (S_OK != m_device->CreatePixelShader(DefaultPixelShaderCode, sizeof(DefaultPixelShaderCode), nullptr, &m_pShader))
     return false;
 
-  // create buffers
-  CD3D11_BUFFER_DESC desc(sizeof(Vertex_t) * NUM_VERTICIES, D3D11_BIND_VERTEX_BUFFER, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
-  if (S_OK != m_device->CreateBuffer(&desc, NULL, &m_vBuffer))
+  // create buffers, the vertex buffer is sized for the grid by BuildLayout()
+  CD3D11_BUFFER_DESC desc(sizeof(cbWorld), D3D11_BIND_CONSTANT_BUFFER, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
+  if (S_OK != m_device->CreateBuffer(&desc, NULL, &m_cWorld))
     return false;
 
-  desc.ByteWidth = sizeof(cbWorld);
-  desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-  if (S_OK != m_device->CreateBuffer(&desc, NULL, &m_cWorld))
+  desc.ByteWidth = sizeof(cbGrid);
+  if (m_compactVertices && S_OK != m_device->CreateBuffer(&desc, NULL, &m_cGrid))
     return false;
 
   cbViewProj cViewProj;
@@ -19,16 +19,26 @@
  *  Ported to GLES 2.0 by Gimli
  */
 
-#define __STDC_LIMIT_MACROS
-
+#include "BarAnimation.h"
+#include "BarShader.h"
+#include "FrameWorker.h"
+#include "OffscreenTarget.h"
+#include "ParticleSystem.h"
+#include "SpectrumEngine.h"
+#include "VertexHeights.h"
+
+#include <kodi/Filesystem.h>
 #include <kodi/addon-instance/Visualization.h>
 #include <kodi/gui/gl/GL.h>
 #include <kodi/gui/gl/Shader.h>
 
 #include <string.h>
 #include <math.h>
-#include <stdint.h>
+#include <time.h>
+#include <algorithm>
 #include <cstddef>
+#include <stdint.h>
+#include <vector>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -38,11 +48,35 @@
 #endif
 
 #define NUM_BANDS 16
+#define NUM_ROWS 16
+#define VERTICES_PER_BAR 48
+
+namespace
+{
+
+// Fraction of the output resolution to draw at for the render_scale
+// setting: full, at most 1080 or 720 lines, or half
+float RenderScale(int setting, int outputHeight)
+{
+  switch (setting)
+  {
+    case 1:
+      return std::min(1080.0f / std::max(outputHeight, 1), 1.0f);
+    case 2:
+      return std::min(720.0f / std::max(outputHeight, 1), 1.0f);
+    case 3:
+      return 0.5f;
+    case 0:
+    default:
+      return 1.0f;
+  }
+}
+
+} // namespace
 
 class ATTR_DLL_LOCAL CVisualizationSpectrum
   : public kodi::addon::CAddonBase,
-    public kodi::addon::CInstanceVisualization,
-    public kodi::gui::gl::CShaderProgram
+    public kodi::addon::CInstanceVisualization
 {
 public:
   CVisualizationSpectrum();
@@ -52,93 +86,241 @@ public:
   void Stop() override;
   void Render() override;
   void AudioData(const float* audioData, size_t audioDataLength) override;
+  void GetInfo(bool& wantsFreq, int& syncDelay) override;
   ADDON_STATUS SetSetting(const std::string& settingName, const kodi::addon::CSettingValue& settingValue) override;
 
-  void OnCompiledAndLinked() override;
-  bool OnEnabled() override;
-
 private:
-  void SetBarHeightSetting(int settingValue);
-  void SetSpeedSetting(int settingValue);
-  void SetModeSetting(int settingValue);
-
-  GLfloat m_heights[16][16];
-  GLfloat m_cHeights[16][16];
-  GLfloat m_scale;
-  GLenum m_mode;
+  // Runs the renderer on a simulated clock, see src/tests/RenderTest.cpp
+  friend class CRenderTest;
+
+  void ApplySettings(const SpectrumSettings& settings);
+  void SetModeSetting(int settingValue, int particles, int pointSize);
+  void StartCapture();
+  void StartExport(int channels);
+  void WriteStatistics();
+
+  // Settings in effect and changes waiting for the next frame boundary
+  SpectrumSettings m_settings;
+  CSettingsQueue m_pendingSettings;
+
+  // Per-bar base colors which stay the same between frames, rebuilt only
+  // when the grid size or the drawing mode changes. Stored as structure of
+  // arrays in row-major bar order. Positions are computed by the vertex
+  // shader from the packed grid coordinates.
+  struct BarLayout
+  {
+    ArenaVector<GLfloat> red;
+    ArenaVector<GLfloat> green;
+    ArenaVector<GLfloat> blue;
+  };
+
+  void BuildLayout();
+
+  // With SPECTRUM_STATIC_ALLOCATION all analysis and render buffers are
+  // carved from m_arena in Start(), sized for the largest grid the settings
+  // allow, so nothing is allocated while visualizing
+  void ReserveBuffers(int channels, int samplesPerSec);
+  void ReportMemory(CMemoryReport& report);
+  void LogMemory();
+  CArena m_arena;
+
+  // Geometry kernel per primitive mode, chosen by SetModeSetting() and
+  // taken over by BuildLayout(). Corners, shading and the vertex count per
+  // bar are compile-time constants of each kernel, so the per-bar loops
+  // have no mode checks. The shader features select the bar shader variant
+  // drawing the kernel.
+  struct RenderKernel
+  {
+    GLenum mode;
+    int verticesPerBar;
+    int shaderFeatures;
+    void (CVisualizationSpectrum::*buildGeometry)(int bars);
+    void (CVisualizationSpectrum::*fillHeights)(ArenaVector<uint8_t>& buffer, const CBarHeights& bars);
+    void (CVisualizationSpectrum::*fillHalfHeights)(ArenaVector<uint8_t>& buffer, const CBarHeights& bars);
+  };
+  static const RenderKernel kSolidKernel;
+  static const RenderKernel kWireframeKernel;
+  static const RenderKernel kPointKernel;
+
+  template<class Kernel>
+  void BuildGeometry(int bars);
+  template<class Kernel, typename T>
+  void FillHeights(ArenaVector<uint8_t>& buffer, const CBarHeights& bars);
+
+  const RenderKernel* m_pendingKernel = &kSolidKernel;
+  const RenderKernel* m_kernel = &kSolidKernel;
+
+  BarLayout m_layout;
+  int m_gridRows = NUM_ROWS;
+  int m_gridCols = NUM_BANDS;
+  bool m_layoutDirty = true;
+
+  CSpectrumEngine m_engine;
   float m_y_angle, m_y_speed, m_y_fixedAngle;
   float m_x_angle, m_x_speed;
   float m_z_angle, m_z_speed;
-  float m_hSpeed;
 
-  void draw_bar(GLfloat x_offset, GLfloat z_offset, GLfloat height, GLfloat red, GLfloat green, GLfloat blue);
-  void draw_bars(void);
+  // 0 off, 1 spin faster, 2 brighter colors, 3 camera shake on beats
+  int m_beatEffect = 0;
+  float m_beatPulse[2] = {0.0f, 0.0f};
+
+  // Fraction of the output resolution drawn, see RenderScale()
+  int m_renderScale = 0;
+  float m_pixelScale = 1.0f;
+  COffscreenTarget m_offscreen;
+  bool m_offscreenLogged = false;
+
+  // Particle mode draws the particle fountains instead of the bars, fed by
+  // the newest row of heights
+  CParticleSystem m_particles;
+  bool m_particleMode = false;
+  float m_energies[2][CParticleSystem::kBands] = {};
+  // On the engine clock
+  double m_startTime = 0.0;
+
+  // With desktop OpenGL the bars are animated on the GPU, the worker only
+  // presents new rows and Render() uploads their targets. Particle mode
+  // and GLES keep the CPU animation and the per vertex heights.
+  CBarAnimation m_animation;
+  bool m_gpuAnimation = false;
+  bool m_targetsChanged = false;
+  void UpdateAnimation();
+
+  void PrepareFrame();
+  void PrepareHeights();
+  void draw_bars(const CBarShader& shader);
+
+  // Bars are drawn front to back for the current rotation through an index
+  // buffer, so the depth test rejects hidden fragments before shading. The
+  // grid is traversed in lines of bars along the axis facing the camera
+  // most; the order only changes when the camera crosses a diagonal or an
+  // axis of the grid. Faces pointing away are culled and lines outside of
+  // the view frustum are skipped.
+  enum DrawOrder
+  {
+    kColumnsOuter = 1,
+    kColumnsDescending = 2,
+    kRowsDescending = 4,
+  };
+
+  bool UpdateDrawOrder();
+  template<typename T>
+  void BuildDrawOrder();
+  bool LineVisible(const glm::mat4& mvp, int line) const;
+  void DrawOrdered();
+
+  ArenaVector<uint8_t> m_index_buffer_data;
+  GLuint m_indexVBO = 0;
+  GLenum m_indexType = GL_UNSIGNED_INT;
+  int m_drawOrder = -1;
+  int m_lines = 0;
+  int m_lineBars = 0;
+  // Upper bound of all displayed bar heights, for the frustum test, and the
+  // largest target it decays to
+  float m_heightBound[2] = {0.0f, 0.0f};
+  float m_maxTarget = 0.0f;
+  // Plain grid order, only set by the render test to compare the fragment
+  // counts of both orders
+  bool m_gridOrder = false;
 
   // Shader related data
   glm::mat4 m_projMat;
   glm::mat4 m_modelMat;
   GLfloat m_pointSize = 0.0f;
-  std::vector<glm::vec3> m_vertex_buffer_data;
-  std::vector<glm::vec3> m_color_buffer_data;
-
-#ifdef HAS_GL
+  GLfloat m_intensity = 1.0f;
+
+  // Per vertex heights, double buffered: the worker fills the back buffer
+  // for the next frame while Render() uploads the front one. Half floats
+  // where supported, 32 bit floats otherwise.
+  CFrameWorker m_worker;
+  ArenaVector<uint8_t> m_height_buffer_data[2];
+  int m_frontBuffer = 0;
+  GLenum m_heightType = GL_FLOAT;
+  GLsizei m_vertexCount = 0;
+
+  // Staging for the static geometry, grid coordinates then colors
+  ArenaVector<uint8_t> m_geometry_buffer_data;
+
+  // Static bar geometry as packed grid coordinates and face shaded colors
+  // as normalized bytes (built by BuildLayout()), and the per vertex heights
+  // streamed every frame
   GLuint m_vertexVBO[2] = {0};
-#endif
+  GLuint m_heightVBO = 0;
+  GLfloat m_gridLayout[4] = {0.0f};
 
-  GLint m_uProjMatrix = -1;
-  GLint m_uModelMatrix = -1;
-  GLint m_uPointSize = -1;
-  GLint m_hPos = -1;
-  GLint m_hCol = -1;
+  CBarShaders m_barShaders;
 
   bool m_startOK = false;
 };
 
 CVisualizationSpectrum::CVisualizationSpectrum()
-  : m_mode(GL_TRIANGLES),
+  : m_engine(NUM_ROWS, NUM_BANDS),
     m_y_angle(45.0f),
     m_y_speed(0.5f),
     m_x_angle(20.0f),
     m_x_speed(0.0f),
     m_z_angle(0.0f),
-    m_z_speed(0.0f),
-    m_hSpeed(0.05f)
+    m_z_speed(0.0f)
 {
-  m_scale = 1.0 / log(256.0);
-
-  SetBarHeightSetting(kodi::addon::GetSettingInt("bar_height"));
-  SetSpeedSetting(kodi::addon::GetSettingInt("speed"));
-  SetModeSetting(kodi::addon::GetSettingInt("mode"));
-  m_y_fixedAngle = kodi::addon::GetSettingInt("rotation_angle");
-
-  m_vertex_buffer_data.resize(48);
-  m_color_buffer_data.resize(48);
+  m_settings.ForEach([](const char* name, int& value) { value = kodi::addon::GetSettingInt(name); });
+  m_pendingSettings.Reset(m_settings);
+  ApplySettings(m_settings);
 }
 
 bool CVisualizationSpectrum::Start(int channels, int samplesPerSec, int bitsPerSample, const std::string& songName)
 {
-  (void)channels;
-  (void)samplesPerSec;
-  (void)bitsPerSample;
-  (void)songName;
-
   std::string fraqShader = kodi::addon::GetAddonPath("resources/shaders/" GL_TYPE_STRING "/frag.glsl");
   std::string vertShader = kodi::addon::GetAddonPath("resources/shaders/" GL_TYPE_STRING "/vert.glsl");
-  if (!LoadShaderFiles(vertShader, fraqShader) || !CompileAndLink())
+  m_barShaders.Init(vertShader, fraqShader);
+  if (!m_barShaders.Get(m_pendingKernel->shaderFeatures))
   {
     kodi::Log(ADDON_LOG_ERROR, "Failed to create or compile shader");
     return false;
   }
+#ifdef SPECTRUM_STATIC_ALLOCATION
+  // Compiling allocates, so the variants other modes need are compiled now
+  for (int features = 0; features < CBarShader::kVariants; features++)
+    m_barShaders.Get(features);
+#endif
 
-  int x, y;
+  if (!m_particles.Init(kodi::addon::GetAddonPath("resources/shaders/" GL_TYPE_STRING "/particle_vert.glsl"),
+                        kodi::addon::GetAddonPath("resources/shaders/" GL_TYPE_STRING "/particle_frag.glsl")))
+    kodi::Log(ADDON_LOG_ERROR, "Failed to create or compile particle shader");
 
-  for(x = 0; x < 16; x++)
+  if (!m_offscreen.Init(kodi::addon::GetAddonPath("resources/shaders/" GL_TYPE_STRING "/composite_vert.glsl"),
+                        kodi::addon::GetAddonPath("resources/shaders/" GL_TYPE_STRING "/composite_frag.glsl")))
+    kodi::Log(ADDON_LOG_ERROR, "Failed to create or compile offscreen shader");
+
+#ifdef HAS_GL
+  if (!m_animation.Init(kodi::addon::GetAddonPath("resources/shaders/" GL_TYPE_STRING "/animate_vert.glsl"),
+                        kodi::addon::GetAddonPath("resources/shaders/" GL_TYPE_STRING "/animate_frag.glsl")))
+    kodi::Log(ADDON_LOG_ERROR, "Failed to create or compile bar animation shader, animating on the CPU");
+#endif
+  m_gpuAnimation = false;
+  m_offscreenLogged = false;
+
+  if (kodi::addon::GetSettingBoolean("capture"))
+    StartCapture();
+  if (kodi::addon::GetSettingBoolean("statistics"))
+    m_engine.StartStatistics(channels);
+  if (kodi::addon::GetSettingBoolean("shared_memory"))
+    StartExport(channels);
+
+#ifdef SPECTRUM_STATIC_ALLOCATION
+  // Measure the buffers for the largest configuration first, then carve
+  // them from one block of that size
+  m_arena.BeginMeasure();
+  ReserveBuffers(channels, samplesPerSec);
+  m_arena.Commit();
+  ReserveBuffers(channels, samplesPerSec);
+#endif
+
+  m_engine.Start(channels, samplesPerSec, bitsPerSample, songName);
+
+  if (m_engine.IsCapturing())
   {
-    for(y = 0; y < 16; y++)
-    {
-      m_heights[y][x] = 0.0f;
-      m_cHeights[y][x] = 0.0f;
-    }
+    // Settings snapshot so a replay starts from the same state
+    m_settings.ForEach([this](const char* name, int& value) { m_engine.RecordSetting(name, value); });
   }
 
   m_x_speed = 0.0f;
@@ -150,27 +332,70 @@ bool CVisualizationSpectrum::Start(int channels, int samplesPerSec, int bitsPerS
 
   m_projMat = glm::frustum(-1.0f, 1.0f, -1.0f, 1.0f, 1.5f, 10.0f);
 
-#ifdef HAS_GL
-  glGenBuffers(2, m_vertexVBO);
+  // Half float heights need GL 3.0, GLES 3.0 or OES_vertex_half_float
+  m_heightType = GL_FLOAT;
+#if defined(HAS_GL) || HAS_GLES >= 3
+  m_heightType = GL_HALF_FLOAT;
+#elif defined(GL_HALF_FLOAT_OES)
+  const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+  if (extensions && strstr(extensions, "GL_OES_vertex_half_float"))
+    m_heightType = GL_HALF_FLOAT_OES;
+#endif
+
+  // GLES 2 can only address 64k vertices per draw call
+#if defined(HAS_GL) || HAS_GLES >= 3
+  m_indexType = GL_UNSIGNED_INT;
+#else
+  m_indexType = GL_UNSIGNED_SHORT;
 #endif
 
+  glGenBuffers(2, m_vertexVBO);
+  glGenBuffers(1, &m_heightVBO);
+  glGenBuffers(1, &m_indexVBO);
+  m_layoutDirty = true;
+
+  m_startTime = m_engine.Now();
+  m_worker.Start([this] { PrepareFrame(); });
+
   m_startOK = true;
   return true;
 }
 
 void CVisualizationSpectrum::Stop()
 {
+  m_worker.Stop();
+
+  // The outputs are only opened once Start() got past everything that can
+  // fail
   if (!m_startOK)
     return;
 
   m_startOK = false;
 
-#ifdef HAS_GL
+  // Kodi's audio thread may still be in AudioData(), the rows it adds
+  // until StopOutputs() are not in the statistics file
+  if (m_engine.IsCollectingStatistics())
+    WriteStatistics();
+  m_engine.StopOutputs();
+
+  if (m_engine.EarlyRows())
+    kodi::Log(ADDON_LOG_WARNING, "Output delay not fully compensated, %llu rows shown early with a full row queue",
+              static_cast<unsigned long long>(m_engine.EarlyRows()));
+  LogMemory();
+
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glDeleteBuffers(2, m_vertexVBO);
+  glDeleteBuffers(1, &m_heightVBO);
+  glDeleteBuffers(1, &m_indexVBO);
   m_vertexVBO[0] = 0;
   m_vertexVBO[1] = 0;
-#endif
+  m_heightVBO = 0;
+  m_indexVBO = 0;
+
+  m_barShaders.Deinit();
+  m_particles.Deinit();
+  m_animation.Deinit();
+  m_offscreen.Deinit();
 }
 
 //-- Render -------------------------------------------------------------------
@@ -181,23 +406,23 @@ void CVisualizationSpectrum::Render()
   if (!m_startOK)
     return;
 
-#ifdef HAS_GL
-  glBindBuffer(GL_ARRAY_BUFFER, m_vertexVBO[0]);
-  glVertexAttribPointer(m_hPos, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat)*3, nullptr);
-  glEnableVertexAttribArray(m_hPos);
-
-  glBindBuffer(GL_ARRAY_BUFFER, m_vertexVBO[1]);
-  glVertexAttribPointer(m_hCol, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat)*3, nullptr);
-  glEnableVertexAttribArray(m_hCol);
-#else
-  // 1rst attribute buffer : vertices
-  glEnableVertexAttribArray(m_hPos);
-  glVertexAttribPointer(m_hPos, 3, GL_FLOAT, GL_FALSE, 0, &m_vertex_buffer_data[0]);
-
-  // 2nd attribute buffer : colors
-  glEnableVertexAttribArray(m_hCol);
-  glVertexAttribPointer(m_hCol, 3, GL_FLOAT, GL_FALSE, 0, &m_color_buffer_data[0]);
-#endif
+  // Take the heights prepared during the last frame and let the worker
+  // start on the next one. Setting changes are applied in between, while
+  // the worker is idle.
+  m_worker.Wait();
+  SpectrumSettings settings;
+  if (m_pendingSettings.Take(settings))
+    ApplySettings(settings);
+  if (m_engine.Bars().Cols() != m_gridCols)
+  {
+    m_gridCols = m_engine.Bars().Cols();
+    m_layoutDirty = true;
+  }
+  if (m_layoutDirty)
+    BuildLayout();
+  UpdateAnimation();
+  m_frontBuffer = 1 - m_frontBuffer;
+  m_worker.Kick();
 
   glDisable(GL_BLEND);
 #ifdef HAS_GL
@@ -206,8 +431,29 @@ void CVisualizationSpectrum::Render()
   glEnable(GL_DEPTH_TEST);
   glDepthFunc(GL_LESS);
 
+  // Reduced resolution draws into our own buffers, which are cleared and
+  // blended scaled up over Kodi's framebuffer at the end
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const float scale = RenderScale(m_renderScale, viewport[3]);
+  const bool offscreen = scale < 1.0f && m_offscreen.Begin(scale);
+  // Point sizes are in pixels of the target drawn into
+  m_pixelScale = offscreen ? scale : 1.0f;
+  if (scale < 1.0f && !offscreen && !m_offscreenLogged)
+  {
+    kodi::Log(ADDON_LOG_INFO, "Reduced render resolution not available, drawing at full resolution");
+    m_offscreenLogged = true;
+  }
+
   // Clear the screen
-  glClear(GL_DEPTH_BUFFER_BIT);
+  if (!offscreen)
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+  // Beats speed up the rotation, brighten the bars or shake the camera
+  const float pulse = m_beatPulse[m_frontBuffer];
+  const float spin = m_beatEffect == 1 ? 1.0f + 4.0f * pulse : 1.0f;
+  const float shake = m_beatEffect == 3 ? 0.05f * pulse : 0.0f;
+  m_intensity = m_beatEffect == 2 ? 1.0f + 0.6f * pulse : 1.0f;
 
   m_x_angle += m_x_speed;
   if(m_x_angle >= 360.0f)
@@ -215,7 +461,7 @@ void CVisualizationSpectrum::Render()
 
   if (m_y_fixedAngle < 0.0f)
   {
-    m_y_angle += m_y_speed;
+    m_y_angle += m_y_speed * spin;
     if(m_y_angle >= 360.0f)
       m_y_angle -= 360.0f;
   }
@@ -228,19 +474,43 @@ void CVisualizationSpectrum::Render()
   if(m_z_angle >= 360.0f)
     m_z_angle -= 360.0f;
 
-  m_modelMat = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.5f, -5.0f));
+  // The shake runs on the stream clock, so it also shakes at a fixed angle
+  const float time = static_cast<float>(m_engine.Now() - m_startTime);
+  m_modelMat = glm::translate(glm::mat4(1.0f), glm::vec3(shake * sinf(time * 47.0f),
+                                                         -0.5f + shake * cosf(time * 61.0f), -5.0f));
   m_modelMat = glm::rotate(m_modelMat, glm::radians(m_x_angle), glm::vec3(1.0f, 0.0f, 0.0f));
   m_modelMat = glm::rotate(m_modelMat, glm::radians(m_y_angle), glm::vec3(0.0f, 1.0f, 0.0f));
   m_modelMat = glm::rotate(m_modelMat, glm::radians(m_z_angle), glm::vec3(0.0f, 0.0f, 1.0f));
 
-  EnableShader();
-
-  draw_bars();
-
-  DisableShader();
+  if (m_particleMode)
+  {
+    m_particles.Draw(m_projMat, m_modelMat, time, m_pointSize * m_pixelScale, m_energies[m_frontBuffer]);
+  }
+  else
+  {
+    if (m_gpuAnimation)
+      m_animation.Step(m_engine.Speed());
+    // Mode changes swap the variant here, the first frame of a new mode
+    // compiles it
+    CBarShader* shader = m_barShaders.Get(m_kernel->shaderFeatures |
+                                          (m_gpuAnimation ? CBarShader::kGpuHeights : 0));
+    if (shader)
+    {
+      BarUniforms uniforms;
+      uniforms.projection = m_projMat;
+      uniforms.modelView = m_modelMat;
+      uniforms.pointSize = m_pointSize * m_pixelScale;
+      uniforms.intensity = m_intensity;
+      std::copy(m_gridLayout, m_gridLayout + 4, uniforms.grid);
+      shader->SetUniforms(uniforms);
+      shader->EnableShader();
+      draw_bars(*shader);
+      shader->DisableShader();
+    }
+  }
 
-  glDisableVertexAttribArray(m_hPos);
-  glDisableVertexAttribArray(m_hCol);
+  if (offscreen)
+    m_offscreen.End();
 
   glDisable(GL_DEPTH_TEST);
 #ifdef HAS_GL
@@ -249,314 +519,593 @@ void CVisualizationSpectrum::Render()
   glEnable(GL_BLEND);
 }
 
-void CVisualizationSpectrum::OnCompiledAndLinked()
+namespace
 {
-  // Variables passed directly to the Vertex shader
-  m_uProjMatrix = glGetUniformLocation(ProgramHandle(), "u_projectionMatrix");
-  m_uModelMatrix = glGetUniformLocation(ProgramHandle(), "u_modelViewMatrix");
-  m_uPointSize = glGetUniformLocation(ProgramHandle(), "u_pointSize");
-  m_hPos = glGetAttribLocation(ProgramHandle(), "a_position");
-  m_hCol = glGetAttribLocation(ProgramHandle(), "a_color");
-}
 
-bool CVisualizationSpectrum::OnEnabled()
+// Corners of one bar in units of the bar width, the y component selects
+// between the bottom (0) and the top (1) of the bar. Drawn as lines by the
+// wireframe kernel.
+const GLfloat kBarCorners[VERTICES_PER_BAR][3] =
 {
-  // This is called after glUseProgram()
-  glUniformMatrix4fv(m_uProjMatrix, 1, GL_FALSE, glm::value_ptr(m_projMat));
-  glUniformMatrix4fv(m_uModelMatrix, 1, GL_FALSE, glm::value_ptr(m_modelMat));
-  glUniform1f(m_uPointSize, m_pointSize);
+  // Bottom
+  { 1, 0, 1 }, { 0, 0, 0 }, { 1, 0, 0 }, { 1, 0, 1 }, { 0, 0, 1 }, { 0, 0, 0 },
+  { 0, 0, 1 }, { 1, 0, 0 }, { 1, 0, 1 }, { 0, 0, 1 }, { 1, 0, 0 }, { 0, 0, 0 },
+
+  // Side
+  { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 0, 0 }, { 0, 1, 1 }, { 0, 1, 0 },
+  { 1, 1, 0 }, { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 }, { 0, 0, 0 },
+  { 0, 1, 1 }, { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 }, { 1, 0, 1 },
+  { 1, 1, 1 }, { 1, 0, 0 }, { 1, 1, 0 }, { 1, 0, 0 }, { 1, 1, 1 }, { 1, 0, 1 },
+
+  // Top
+  { 1, 1, 1 }, { 1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 1 }, { 0, 1, 0 }, { 0, 1, 1 },
+  { 0, 1, 1 }, { 1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 1, 1 }, { 0, 1, 1 }
+};
 
-  return true;
-}
+// Solid bars as two triangles per face, counter-clockwise seen from
+// outside so faces pointing away from the camera can be culled
+const GLfloat kSolidCorners[36][3] =
+{
+  // Bottom
+  { 1, 0, 1 }, { 0, 0, 0 }, { 1, 0, 0 }, { 1, 0, 1 }, { 0, 0, 1 }, { 0, 0, 0 },
 
-void CVisualizationSpectrum::draw_bar(GLfloat x_offset, GLfloat z_offset, GLfloat height, GLfloat red, GLfloat green, GLfloat blue )
+  // Sides
+  { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 0, 0 }, { 0, 1, 1 }, { 0, 1, 0 },
+  { 1, 1, 0 }, { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 }, { 0, 0, 0 },
+  { 0, 1, 1 }, { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 }, { 1, 0, 1 },
+  { 1, 1, 1 }, { 1, 0, 0 }, { 1, 1, 0 }, { 1, 0, 0 }, { 1, 1, 1 }, { 1, 0, 1 },
+
+  // Top
+  { 1, 1, 1 }, { 1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 1 }, { 0, 1, 0 }, { 0, 1, 1 }
+};
+
+// Shading of each face of solid bars
+const GLfloat kSolidShade[6] = { 1.0f, 0.5f, 0.25f, 0.75f, 0.5f, 1.0f };
+
+// Points only need every corner once
+const GLfloat kCubeCorners[8][3] =
 {
-  GLfloat width = 0.1f;
-  m_vertex_buffer_data =
-  {
-    // Bottom
-    { x_offset + width, 0.0f,   z_offset + width },
-    { x_offset,         0.0f,   z_offset },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset + width, 0.0f,   z_offset + width },
-    { x_offset,         0.0f,   z_offset + width },
-    { x_offset,         0.0f,   z_offset },
-
-    { x_offset,         0.0f,   z_offset + width },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset + width, 0.0f,   z_offset + width },
-    { x_offset,         0.0f,   z_offset + width },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset,         0.0f,   z_offset },
-
-    // Side
-    { x_offset,         0.0f,   z_offset },
-    { x_offset,         0.0f,   z_offset + width },
-    { x_offset,         height, z_offset + width },
-    { x_offset,         0.0f,   z_offset },
-    { x_offset,         height, z_offset + width },
-    { x_offset,         height, z_offset },
-
-    { x_offset + width, height, z_offset },
-    { x_offset,         0.0f,   z_offset },
-    { x_offset,         height, z_offset },
-    { x_offset + width, height, z_offset },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset,         0.0f,   z_offset },
-
-    { x_offset,         height, z_offset + width },
-    { x_offset,         0.0f,   z_offset + width },
-    { x_offset + width, 0.0f,   z_offset + width },
-    { x_offset + width, height, z_offset + width },
-    { x_offset,         height, z_offset + width },
-    { x_offset + width, 0.0f,   z_offset + width },
-
-    { x_offset + width, height, z_offset + width },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset + width, height, z_offset },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset + width, height, z_offset + width },
-    { x_offset + width, 0.0f,   z_offset + width },
-
-    // Top
-    { x_offset + width, height, z_offset + width },
-    { x_offset + width, height, z_offset },
-    { x_offset,         height, z_offset },
-    { x_offset + width, height, z_offset + width },
-    { x_offset,         height, z_offset },
-    { x_offset,         height, z_offset + width },
-
-    { x_offset,         height, z_offset + width },
-    { x_offset + width, height, z_offset },
-    { x_offset,         height, z_offset },
-    { x_offset + width, height, z_offset },
-    { x_offset + width, height, z_offset + width },
-    { x_offset,         height, z_offset + width }
-  };
+  { 0, 0, 0 }, { 1, 0, 0 }, { 0, 0, 1 }, { 1, 0, 1 },
+  { 0, 1, 0 }, { 1, 1, 0 }, { 0, 1, 1 }, { 1, 1, 1 }
+};
 
-  float sideMlpy1, sideMlpy2, sideMlpy3, sideMlpy4;
-  if (m_mode == GL_TRIANGLES)
-  {
-    sideMlpy1 = 0.5f;
-    sideMlpy2 = 0.25f;
-    sideMlpy3 = 0.75f;
-    sideMlpy4 = 0.5f;
-  }
-  else
+struct SolidKernel
+{
+  static constexpr int kVertices = 36;
+  static const GLfloat* Corner(int v) { return kSolidCorners[v]; }
+  static GLfloat Shade(int v) { return kSolidShade[v / 6]; }
+};
+
+struct WireframeKernel
+{
+  static constexpr int kVertices = VERTICES_PER_BAR;
+  static const GLfloat* Corner(int v) { return kBarCorners[v]; }
+  static GLfloat Shade(int) { return 1.0f; }
+};
+
+struct PointKernel
+{
+  static constexpr int kVertices = 8;
+  static const GLfloat* Corner(int v) { return kCubeCorners[v]; }
+  static GLfloat Shade(int) { return 1.0f; }
+};
+
+} // namespace
+
+const CVisualizationSpectrum::RenderKernel CVisualizationSpectrum::kSolidKernel =
+{
+  GL_TRIANGLES, SolidKernel::kVertices, 0,
+  &CVisualizationSpectrum::BuildGeometry<SolidKernel>,
+  &CVisualizationSpectrum::FillHeights<SolidKernel, GLfloat>, &CVisualizationSpectrum::FillHeights<SolidKernel, GLushort>
+};
+
+const CVisualizationSpectrum::RenderKernel CVisualizationSpectrum::kWireframeKernel =
+{
+  GL_LINES, WireframeKernel::kVertices, 0,
+  &CVisualizationSpectrum::BuildGeometry<WireframeKernel>,
+  &CVisualizationSpectrum::FillHeights<WireframeKernel, GLfloat>, &CVisualizationSpectrum::FillHeights<WireframeKernel, GLushort>
+};
+
+const CVisualizationSpectrum::RenderKernel CVisualizationSpectrum::kPointKernel =
+{
+  GL_POINTS, PointKernel::kVertices, CBarShader::kPoints,
+  &CVisualizationSpectrum::BuildGeometry<PointKernel>,
+  &CVisualizationSpectrum::FillHeights<PointKernel, GLfloat>, &CVisualizationSpectrum::FillHeights<PointKernel, GLushort>
+};
+
+void CVisualizationSpectrum::BuildLayout()
+{
+  const int bars = m_gridRows * m_gridCols;
+  const GLfloat spacing = 3.2f / m_gridCols;
+
+  m_layout.red.resize(bars);
+  m_layout.green.resize(bars);
+  m_layout.blue.resize(bars);
+
+  for (int y = 0; y < m_gridRows; y++)
   {
-    sideMlpy1 = sideMlpy2 = sideMlpy3 = sideMlpy4 = 1.0f;
+    const GLfloat b_base = float(y) / (m_gridRows - 1);
+    const GLfloat r_base = 1.0f - b_base;
+
+    for (int x = 0; x < m_gridCols; x++)
+    {
+      const int bar = y * m_gridCols + x;
+      m_layout.red[bar] = r_base - float(x) * (r_base / (m_gridCols - 1));
+      m_layout.green[bar] = float(x) / (m_gridCols - 1);
+      m_layout.blue[bar] = b_base;
+    }
   }
 
-  // One color for each vertex. They were generated randomly.
-  m_color_buffer_data =
+  // Bar spacing, bar width, the last row and the columns for the vertex
+  // shader
+  m_gridLayout[0] = spacing;
+  m_gridLayout[1] = spacing * 0.5f;
+  m_gridLayout[2] = GLfloat(m_gridRows - 1);
+  m_gridLayout[3] = GLfloat(m_gridCols);
+
+  // The worker is idle here, so the kernel can be switched safely
+  m_kernel = m_pendingKernel;
+  (this->*m_kernel->buildGeometry)(bars);
+
+  m_vertexCount = bars * m_kernel->verticesPerBar;
+  const size_t heightSize = m_heightType == GL_FLOAT ? sizeof(GLfloat) : sizeof(GLushort);
+  m_height_buffer_data[0].assign(m_vertexCount * heightSize, 0);
+  m_height_buffer_data[1].assign(m_vertexCount * heightSize, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, m_heightVBO);
+  glBufferData(GL_ARRAY_BUFFER, m_height_buffer_data[0].size(), nullptr, GL_STREAM_DRAW);
+
+  m_drawOrder = -1;
+  m_layoutDirty = false;
+}
+
+void CVisualizationSpectrum::ReserveBuffers(int channels, int samplesPerSec)
+{
+  m_engine.ReserveBuffers(m_arena, channels, samplesPerSec);
+
+  const size_t bars = size_t(NUM_ROWS) * m_engine.MaxCols(channels);
+  ReserveBuffer(m_layout.red, m_arena, bars);
+  ReserveBuffer(m_layout.green, m_arena, bars);
+  ReserveBuffer(m_layout.blue, m_arena, bars);
+  ReserveBuffer(m_geometry_buffer_data, m_arena, 2 * bars * VERTICES_PER_BAR * 4);
+  ReserveBuffer(m_height_buffer_data[0], m_arena, bars * VERTICES_PER_BAR * sizeof(GLfloat));
+  ReserveBuffer(m_height_buffer_data[1], m_arena, bars * VERTICES_PER_BAR * sizeof(GLfloat));
+  ReserveBuffer(m_index_buffer_data, m_arena, bars * VERTICES_PER_BAR * sizeof(GLuint));
+}
+
+void CVisualizationSpectrum::ReportMemory(CMemoryReport& report)
+{
+  m_engine.ReportMemory(report);
+
+  // The static geometry is 4 bytes of grid coordinates and 4 of color per
+  // vertex, the heights buffer matches one of the CPU side copies
+  report.Add("bar geometry",
+             BufferBytes(m_layout.red) + BufferBytes(m_layout.green) + BufferBytes(m_layout.blue) +
+                 BufferBytes(m_geometry_buffer_data),
+             size_t(m_vertexCount) * 8);
+  report.Add("bar heights upload", BufferBytes(m_height_buffer_data[0]) + BufferBytes(m_height_buffer_data[1]),
+             m_height_buffer_data[0].size());
+  report.Add("bar draw order", BufferBytes(m_index_buffer_data), m_index_buffer_data.size());
+  report.Add("bar animation", 0, m_animation.GpuBytes());
+  report.Add("particles", 0, m_particles.GpuBytes());
+  report.Add("offscreen target", 0, m_offscreen.GpuBytes());
+}
+
+void CVisualizationSpectrum::LogMemory()
+{
+  CMemoryReport report;
+  ReportMemory(report);
+  for (const CMemoryReport::Entry& entry : report.Entries())
+    kodi::Log(ADDON_LOG_DEBUG, "Memory of %s: %zu bytes CPU, %zu bytes GPU", entry.subsystem.c_str(),
+              entry.cpuBytes, entry.gpuBytes);
+  kodi::Log(ADDON_LOG_DEBUG, "Memory total: %zu bytes CPU, %zu bytes GPU", report.CpuBytes(), report.GpuBytes());
+#ifdef SPECTRUM_STATIC_ALLOCATION
+  kodi::Log(ADDON_LOG_DEBUG, "Memory arena: %zu of %zu bytes used", m_arena.Used(), m_arena.Capacity());
+  if (m_arena.Overflow())
+    kodi::Log(ADDON_LOG_WARNING, "Memory arena too small, %zu bytes taken from the heap", m_arena.Overflow());
+#endif
+}
+
+template<class Kernel>
+void CVisualizationSpectrum::BuildGeometry(int bars)
+{
+  // 4 bytes per vertex each: column, row and the corner as bits
+  // (x | y << 1 | z << 2), and the face shaded color
+  const size_t size = bars * Kernel::kVertices * 4;
+  m_geometry_buffer_data.resize(2 * size);
+  uint8_t* grid_buffer_data = m_geometry_buffer_data.data();
+  uint8_t* color_buffer_data = grid_buffer_data + size;
+
+  for (int bar = 0; bar < bars; bar++)
   {
-    // Bottom
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-
-    // Side
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-
-    // Top
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-  };
+    uint8_t* grid = &grid_buffer_data[bar * Kernel::kVertices * 4];
+    uint8_t* color = &color_buffer_data[bar * Kernel::kVertices * 4];
+
+    for (int v = 0; v < Kernel::kVertices; v++)
+    {
+      const GLfloat* corner = Kernel::Corner(v);
+      const float mlpy = Kernel::Shade(v) * 255.0f;
+      grid[v * 4 + 0] = uint8_t(bar % m_gridCols);
+      grid[v * 4 + 1] = uint8_t(bar / m_gridCols);
+      grid[v * 4 + 2] = uint8_t(corner[0] + 2 * corner[1] + 4 * corner[2]);
+      grid[v * 4 + 3] = 0;
+      color[v * 4 + 0] = uint8_t(m_layout.red[bar] * mlpy + 0.5f);
+      color[v * 4 + 1] = uint8_t(m_layout.green[bar] * mlpy + 0.5f);
+      color[v * 4 + 2] = uint8_t(m_layout.blue[bar] * mlpy + 0.5f);
+      color[v * 4 + 3] = 255;
+    }
+  }
 
-#ifdef HAS_GL
   glBindBuffer(GL_ARRAY_BUFFER, m_vertexVBO[0]);
-  glBufferData(GL_ARRAY_BUFFER, m_vertex_buffer_data.size()*sizeof(glm::vec3), &m_vertex_buffer_data[0], GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, size, grid_buffer_data, GL_STATIC_DRAW);
   glBindBuffer(GL_ARRAY_BUFFER, m_vertexVBO[1]);
-  glBufferData(GL_ARRAY_BUFFER, m_color_buffer_data.size()*sizeof(glm::vec3), &m_color_buffer_data[0], GL_STATIC_DRAW);
-#endif
-  glDrawArrays(m_mode, 0, m_vertex_buffer_data.size()); /* 12*3 indices starting at 0 -> 12 triangles + 4*3 to have on lines show correct */
+  glBufferData(GL_ARRAY_BUFFER, size, color_buffer_data, GL_STATIC_DRAW);
 }
 
-void CVisualizationSpectrum::draw_bars(void)
+template<class Kernel, typename T>
+void CVisualizationSpectrum::FillHeights(ArenaVector<uint8_t>& buffer, const CBarHeights& bars)
 {
-  int x, y;
-  GLfloat x_offset, z_offset, r_base, b_base;
+  // Bars only get cut off while the buffer waits for a pending grid resize
+  const size_t count = std::min(bars.Count(), buffer.size() / (Kernel::kVertices * sizeof(T)));
+  ExpandHeights<Kernel::kVertices>(reinterpret_cast<T*>(buffer.data()), bars.Current(), 0, count);
+}
 
-  for(y = 0; y < 16; y++)
+//-- PrepareFrame -------------------------------------------------------------
+// Runs on the worker thread while the previous frame is drawn. Must not
+// call any GL function.
+//-----------------------------------------------------------------------------
+void CVisualizationSpectrum::PrepareFrame()
+{
+  // Animation step runs as its own pass over the whole grid, geometry only
+  // consumes the result. Bars animated on the GPU only need the new rows,
+  // Render() uploads their targets.
+  const bool changed = m_engine.Animate(!m_gpuAnimation);
+  m_beatPulse[1 - m_frontBuffer] = m_engine.BeatPulse();
+
+  // Displayed heights step towards their targets by at most the speed per
+  // frame, on the CPU as on the GPU. Above the largest target they can only
+  // come down, so the bound decays to it by one step per frame.
+  const CBarHeights& bars = m_engine.Bars();
+  if (changed)
+    m_maxTarget = bars.Count() ? *std::max_element(bars.Target(), bars.Target() + bars.Count()) : 0.0f;
+  m_heightBound[1 - m_frontBuffer] = std::max(m_maxTarget, m_heightBound[m_frontBuffer] - m_engine.Speed());
+
+  if (m_gpuAnimation)
   {
-    z_offset = -1.6 + ((15 - y) * 0.2);
+    if (changed)
+      m_targetsChanged = true;
+    return;
+  }
 
-    b_base = y * (1.0 / 15);
-    r_base = 1.0 - b_base;
+  PrepareHeights();
+}
 
-    for(x = 0; x < 16; x++)
+void CVisualizationSpectrum::PrepareHeights()
+{
+  CParticleSystem::Energies(m_engine.Bars().Current(), m_engine.Bars().Cols(), m_energies[1 - m_frontBuffer]);
+
+  (this->*(m_heightType == GL_FLOAT ? m_kernel->fillHeights : m_kernel->fillHalfHeights))(
+      m_height_buffer_data[1 - m_frontBuffer], m_engine.Bars());
+}
+
+void CVisualizationSpectrum::UpdateAnimation()
+{
+  // The worker is idle here, so the engine's heights can be read directly
+  const bool gpuAnimation = m_animation.IsReady() && !m_particleMode;
+  if (gpuAnimation)
+  {
+    const CBarHeights& bars = m_engine.Bars();
+    if (!m_gpuAnimation || m_animation.Bars() != bars.Count())
     {
-      x_offset = -1.6 + ((float)x * 0.2);
-      if (::fabs(m_cHeights[y][x]-m_heights[y][x])>m_hSpeed)
-      {
-        if (m_cHeights[y][x]<m_heights[y][x])
-          m_cHeights[y][x] += m_hSpeed;
-        else
-          m_cHeights[y][x] -= m_hSpeed;
-      }
-      draw_bar(x_offset, z_offset, m_cHeights[y][x], r_base - (float(x) * (r_base / 15.0)), (float)x * (1.0 / 15), b_base);
+      // Continue from where the CPU animation or the resized grid is
+      m_animation.Reset(bars.Current(), bars.Count());
+      m_targetsChanged = true;
     }
+    if (m_targetsChanged)
+      m_animation.SetTargets(bars.Target());
   }
+  else if (m_gpuAnimation)
+  {
+    // Continue on the CPU from the heights the GPU shows, the worker
+    // skipped the buffers for this frame while they were frozen
+    if (const float* heights = m_animation.MapHeights())
+    {
+      m_engine.SetCurrentHeights(heights, m_animation.Bars());
+      m_animation.UnmapHeights();
+    }
+    PrepareHeights();
+  }
+
+  m_targetsChanged = false;
+  m_gpuAnimation = gpuAnimation;
 }
 
-void CVisualizationSpectrum::AudioData(const float* pAudioData, size_t iAudioDataLength)
+void CVisualizationSpectrum::draw_bars(const CBarShader& shader)
 {
-  int i,c;
-  int y=0;
-  GLfloat val;
+  const GLint grid = shader.GridAttribute();
+  const GLint color = shader.ColorAttribute();
+  const GLint height = shader.HeightAttribute();
+  const ArenaVector<uint8_t>& buffer = m_height_buffer_data[m_frontBuffer];
 
-  int xscale[] = {0, 1, 2, 3, 5, 7, 10, 14, 20, 28, 40, 54, 74, 101, 137, 187, 255};
+  // 1rst attribute buffer : packed grid coordinates
+  glBindBuffer(GL_ARRAY_BUFFER, m_vertexVBO[0]);
+  glVertexAttribPointer(grid, 4, GL_UNSIGNED_BYTE, GL_FALSE, 4, nullptr);
+  glEnableVertexAttribArray(grid);
 
-  for(y = 15; y > 0; y--)
+  // 2nd attribute buffer : colors
+  glBindBuffer(GL_ARRAY_BUFFER, m_vertexVBO[1]);
+  glVertexAttribPointer(color, 4, GL_UNSIGNED_BYTE, GL_TRUE, 4, nullptr);
+  glEnableVertexAttribArray(color);
+
+  // Only the heights change between frames, geometry and colors stay in the
+  // static buffers created by BuildLayout(). Heights animated on the GPU
+  // are fetched per bar by the vertex shader instead.
+#ifdef HAS_GL
+  if (m_gpuAnimation)
   {
-    for(i = 0; i < 16; i++)
-    {
-      m_heights[y][i] = m_heights[y - 1][i];
-    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, m_animation.Heights());
+  }
+  else
+#endif
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, m_heightVBO);
+    glBufferData(GL_ARRAY_BUFFER, buffer.size(), buffer.data(), GL_STREAM_DRAW);
+    glVertexAttribPointer(height, 1, m_heightType, GL_FALSE, 0, nullptr);
+    glEnableVertexAttribArray(height);
+  }
+
+  if (!m_gridOrder && UpdateDrawOrder())
+    DrawOrdered();
+  else
+    glDrawArrays(m_kernel->mode, 0, m_vertexCount);
+
+  glDisableVertexAttribArray(grid);
+  glDisableVertexAttribArray(color);
+  if (height >= 0)
+    glDisableVertexAttribArray(height);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+#ifdef HAS_GL
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+#endif
+}
+
+bool CVisualizationSpectrum::UpdateDrawOrder()
+{
+  if (m_indexType == GL_UNSIGNED_SHORT && m_vertexCount > 65536)
+    return false;
+
+  // Camera position in grid space, the grid is centered on the origin
+  const glm::vec4 eye = glm::inverse(m_modelMat) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+  int order = 0;
+  if (std::abs(eye.x) > std::abs(eye.z))
+    order |= kColumnsOuter;
+  if (eye.x > 0.0f)
+    order |= kColumnsDescending;
+  // Rows are laid out towards -z, row 0 is at the front
+  if (eye.z <= 0.0f)
+    order |= kRowsDescending;
+
+  if (order != m_drawOrder)
+  {
+    m_drawOrder = order;
+    if (m_indexType == GL_UNSIGNED_INT)
+      BuildDrawOrder<GLuint>();
+    else
+      BuildDrawOrder<GLushort>();
   }
+  return true;
+}
 
-  for(i = 0; i < NUM_BANDS; i++)
+template<typename T>
+void CVisualizationSpectrum::BuildDrawOrder()
+{
+  const bool columnsOuter = m_drawOrder & kColumnsOuter;
+  const int verticesPerBar = m_kernel->verticesPerBar;
+  m_lines = columnsOuter ? m_gridCols : m_gridRows;
+  m_lineBars = columnsOuter ? m_gridRows : m_gridCols;
+
+  m_index_buffer_data.resize(size_t(m_vertexCount) * sizeof(T));
+  T* index = reinterpret_cast<T*>(m_index_buffer_data.data());
+  for (int line = 0; line < m_lines; line++)
   {
-    for(c = xscale[i], y = 0; c < xscale[i + 1]; c++)
+    for (int i = 0; i < m_lineBars; i++)
     {
-      if (c<iAudioDataLength)
-      {
-        if((int)(pAudioData[c] * (INT16_MAX)) > y)
-          y = (int)(pAudioData[c] * (INT16_MAX));
-      }
-      else
-        continue;
+      int x = columnsOuter ? line : i;
+      int y = columnsOuter ? i : line;
+      if (m_drawOrder & kColumnsDescending)
+        x = m_gridCols - 1 - x;
+      if (m_drawOrder & kRowsDescending)
+        y = m_gridRows - 1 - y;
+
+      const int first = (y * m_gridCols + x) * verticesPerBar;
+      for (int v = 0; v < verticesPerBar; v++)
+        *index++ = T(first + v);
     }
-    y >>= 7;
-    if(y > 0)
-      val = (logf(y) * m_scale);
-    else
-      val = 0;
-    m_heights[0][i] = val;
   }
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexVBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer_data.size(), m_index_buffer_data.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
-void CVisualizationSpectrum::SetBarHeightSetting(int settingValue)
+bool CVisualizationSpectrum::LineVisible(const glm::mat4& mvp, int line) const
 {
-  switch (settingValue)
+  // Bounding box of the line in grid space, same mapping as the vertex
+  // shader
+  const bool columnsOuter = m_drawOrder & kColumnsOuter;
+  const GLfloat spacing = m_gridLayout[0];
+  const GLfloat width = m_gridLayout[1];
+  glm::vec3 lo(-1.6f, 0.0f, -1.6f);
+  glm::vec3 hi(-1.6f + (m_gridCols - 1) * spacing + width, m_heightBound[m_frontBuffer],
+               -1.6f + (m_gridRows - 1) * spacing + width);
+  if (columnsOuter)
+  {
+    const int x = m_drawOrder & kColumnsDescending ? m_gridCols - 1 - line : line;
+    lo.x = -1.6f + x * spacing;
+    hi.x = lo.x + width;
+  }
+  else
+  {
+    const int y = m_drawOrder & kRowsDescending ? m_gridRows - 1 - line : line;
+    lo.z = -1.6f + (m_gridRows - 1 - y) * spacing;
+    hi.z = lo.z + width;
+  }
+
+  // Outside if all corners are beyond the same clip plane
+  int outside[6] = {0};
+  for (int corner = 0; corner < 8; corner++)
   {
-  case 1://standard
-    m_scale = 1.f / log(256.f);
-    break;
-
-  case 2://big
-    m_scale = 2.f / log(256.f);
-    break;
-
-  case 3://real big
-    m_scale = 3.f / log(256.f);
-    break;
-
-  case 4://unused
-    m_scale = 0.33f / log(256.f);
-    break;
-
-  case 0://small
-  default:
-    m_scale = 0.5f / log(256.f);
-    break;
+    const glm::vec4 p = mvp * glm::vec4(corner & 1 ? hi.x : lo.x, corner & 2 ? hi.y : lo.y,
+                                        corner & 4 ? hi.z : lo.z, 1.0f);
+    outside[0] += p.x < -p.w;
+    outside[1] += p.x > p.w;
+    outside[2] += p.y < -p.w;
+    outside[3] += p.y > p.w;
+    outside[4] += p.z < -p.w;
+    outside[5] += p.z > p.w;
   }
+  return std::find(outside, outside + 6, 8) == outside + 6;
 }
 
-void CVisualizationSpectrum::SetSpeedSetting(int settingValue)
+void CVisualizationSpectrum::DrawOrdered()
 {
-  switch (settingValue)
+  const size_t indexSize = m_indexType == GL_UNSIGNED_INT ? sizeof(GLuint) : sizeof(GLushort);
+  const GLsizei lineIndices = m_lineBars * m_kernel->verticesPerBar;
+  const glm::mat4 mvp = m_projMat * m_modelMat;
+
+  // Only solid bars are closed, lines and points stay visible from behind
+  if (m_kernel->mode == GL_TRIANGLES)
   {
-  case 1:
-    m_hSpeed = 0.025f;
-    break;
-
-  case 2:
-    m_hSpeed = 0.0125f;
-    break;
-
-  case 3:
-    m_hSpeed = 0.1f;
-    break;
-
-  case 4:
-    m_hSpeed = 0.2f;
-    break;
-
-  case 0:
-  default:
-    m_hSpeed = 0.05f;
-    break;
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glFrontFace(GL_CCW);
   }
+
+  // Consecutive visible lines are drawn with one call
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexVBO);
+  int first = -1;
+  for (int line = 0; line <= m_lines; line++)
+  {
+    const bool visible = line < m_lines && LineVisible(mvp, line);
+    if (visible && first < 0)
+    {
+      first = line;
+    }
+    else if (!visible && first >= 0)
+    {
+      glDrawElements(m_kernel->mode, (line - first) * lineIndices, m_indexType,
+                     reinterpret_cast<const void*>(first * lineIndices * indexSize));
+      first = -1;
+    }
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  glDisable(GL_CULL_FACE);
 }
 
-void CVisualizationSpectrum::SetModeSetting(int settingValue)
+void CVisualizationSpectrum::AudioData(const float* pAudioData, size_t iAudioDataLength)
 {
+  m_engine.AudioData(pAudioData, iAudioDataLength);
+}
+
+void CVisualizationSpectrum::GetInfo(bool& wantsFreq, int& syncDelay)
+{
+  // Kodi holds back this many buffers before passing them on, covering the
+  // configured output delay as far as our own latency doesn't already
+  wantsFreq = false;
+  syncDelay = m_engine.SyncDelay();
+  kodi::Log(ADDON_LOG_DEBUG, "Visualization latency %.1f ms, holding back %d audio buffers",
+            m_engine.Latency() * 1000.0, syncDelay);
+}
+
+void CVisualizationSpectrum::ApplySettings(const SpectrumSettings& settings)
+{
+  m_settings = settings;
+  m_engine.ApplySettings(settings);
+  SetModeSetting(settings.mode, settings.particles, settings.pointSize);
+  m_y_fixedAngle = settings.rotationAngle;
+  m_beatEffect = settings.beatEffect;
+  m_renderScale = settings.renderScale;
+}
+
+void CVisualizationSpectrum::SetModeSetting(int settingValue, int particles, int pointSize)
+{
+  const RenderKernel* kernel = m_kernel;
+
+  m_particleMode = particles != 0;
+  if (m_particleMode)
+  {
+    // No bars are drawn, the cheapest kernel keeps the worker's share small
+    settingValue = 2;
+  }
+
   switch (settingValue)
   {
     case 1:
-      m_mode = GL_LINES;
+      m_pendingKernel = &kWireframeKernel;
       m_pointSize = 0.0f;
       break;
 
     case 2:
-      m_mode = GL_POINTS;
-      m_pointSize = kodi::addon::GetSettingInt("pointsize");
+      m_pendingKernel = &kPointKernel;
+      m_pointSize = pointSize;
       break;
 
     case 0:
     default:
-      m_mode = GL_TRIANGLES;
+      m_pendingKernel = &kSolidKernel;
       m_pointSize = 0.0f;
       break;
   }
+
+  // Geometry and face shading depend on the mode
+  if (m_pendingKernel != kernel)
+    m_layoutDirty = true;
+}
+
+void CVisualizationSpectrum::StartCapture()
+{
+  const std::string dir = kodi::addon::GetUserPath();
+  if (!kodi::vfs::DirectoryExists(dir))
+    kodi::vfs::CreateDirectory(dir);
+
+  char name[64];
+  const time_t now = time(nullptr);
+  strftime(name, sizeof(name), "capture-%Y%m%d-%H%M%S.spcp", localtime(&now));
+
+  const std::string path = kodi::addon::GetUserPath(name);
+  if (m_engine.StartCapture(path))
+    kodi::Log(ADDON_LOG_INFO, "Recording session to %s", path.c_str());
+  else
+    kodi::Log(ADDON_LOG_ERROR, "Failed to open capture file %s", path.c_str());
+}
+
+void CVisualizationSpectrum::StartExport(int channels)
+{
+  if (m_engine.StartExport(kSpectrumExportName, channels))
+    kodi::Log(ADDON_LOG_INFO, "Publishing the spectrum to shared memory %s", kSpectrumExportName);
+  else
+    kodi::Log(ADDON_LOG_ERROR, "Failed to create shared memory %s", kSpectrumExportName);
+}
+
+void CVisualizationSpectrum::WriteStatistics()
+{
+  const std::string dir = kodi::addon::GetUserPath();
+  if (!kodi::vfs::DirectoryExists(dir))
+    kodi::vfs::CreateDirectory(dir);
+
+  char name[64];
+  const time_t now = time(nullptr);
+  strftime(name, sizeof(name), "statistics-%Y%m%d-%H%M%S.csv", localtime(&now));
+
+  const std::string path = kodi::addon::GetUserPath(name);
+  StatisticsSummary summary;
+  if (m_engine.WriteStatistics(path, summary))
+    kodi::Log(ADDON_LOG_INFO, "Statistics of %llu rows written to %s: mean height %.3f, %.1f%% at full height, %.1f%% at zero",
+              static_cast<unsigned long long>(summary.rows), path.c_str(), summary.meanHeight,
+              summary.clipRate * 100.0, summary.zeroRate * 100.0);
+  else
+    kodi::Log(ADDON_LOG_ERROR, "Failed to write statistics file %s", path.c_str());
 }
 
 //-- SetSetting ---------------------------------------------------------------
@@ -568,26 +1117,19 @@ ADDON_STATUS CVisualizationSpectrum::SetSetting(const std::string& settingName,
   if (settingName.empty() || settingValue.empty())
     return ADDON_STATUS_UNKNOWN;
 
-  if (settingName == "bar_height")
-  {
-    SetBarHeightSetting(settingValue.GetInt());
-    return ADDON_STATUS_OK;
-  }
-  else if (settingName == "speed")
+  if (IsOutputSetting(settingName))
   {
-    SetSpeedSetting(settingValue.GetInt());
+    kodi::Log(ADDON_LOG_DEBUG, "Setting %s %s, takes effect with the next song", settingName.c_str(),
+              settingValue.GetBoolean() ? "on" : "off");
     return ADDON_STATUS_OK;
   }
-  else if (settingName == "mode")
-  {
-    SetModeSetting(settingValue.GetInt());
-    return ADDON_STATUS_OK;
-  }
-  else if (settingName == "rotation_angle")
-  {
-    m_y_fixedAngle = settingValue.GetInt();
+
+  m_engine.RecordSetting(settingName, settingValue.GetInt());
+
+  // Only recorded here, Render() applies all changes made since the last
+  // frame at once
+  if (m_pendingSettings.Set(settingName, settingValue.GetInt()))
     return ADDON_STATUS_OK;
-  }
 
   return ADDON_STATUS_UNKNOWN;
 }
@@ -0,0 +1,165 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+// The engine built with SPECTRUM_STATIC_ALLOCATION must not touch the heap
+// once Start() has sized its arena: neither in AudioData() and Animate(),
+// nor when settings change one at a time through SetSetting() or as a
+// snapshot through ApplySettings(), for every value each setting has in
+// settings.xml. The arena must not overflow either.
+
+#include "../Memory.h"
+#include "../Settings.h"
+#include "../SpectrumEngine.h"
+#include "../tools/AllocationCounter.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#ifndef SPECTRUM_STATIC_ALLOCATION
+#error "The allocation test needs a SPECTRUM_STATIC_ALLOCATION build"
+#endif
+
+namespace
+{
+
+const int kSampleRate = 48000;
+const int kBlockFrames = 960;
+const double kFrameRate = 60.0;
+
+struct EngineSetting
+{
+  const char* name;
+  int minimum;
+  int maximum;
+  int step;
+};
+
+// The settings the engine handles, with their values from settings.xml
+const EngineSetting kSettings[] = {
+  { "bar_height", 0, 3, 1 },
+  { "scaling", 0, 3, 1 },
+  { "auto_gain", 0, 2, 1 },
+  { "speed", 0, 3, 1 },
+  { "window_size", 0, 3, 1 },
+  { "overlap", 0, 3, 1 },
+  { "channel_mode", 0, 2, 1 },
+  { "output_delay", 0, 500, 50 },
+};
+
+class CAllocationTest
+{
+public:
+  explicit CAllocationTest(int channels) : m_channels(channels), m_engine(16, 16)
+  {
+    m_engine.SetClock([this] { return m_now; });
+  }
+
+  bool Run()
+  {
+    m_engine.StartStatistics(m_channels);
+    m_arena.BeginMeasure();
+    m_engine.ReserveBuffers(m_arena, m_channels, kSampleRate);
+    m_arena.Commit();
+    m_engine.ReserveBuffers(m_arena, m_channels, kSampleRate);
+    m_engine.Start(m_channels, kSampleRate, 16, "Allocation test");
+
+    uint64_t allocations = 0;
+    allocations += CountAllocations([this] { Play(1.0); });
+
+    // Every value of every setting, one change at a time
+    for (const EngineSetting& setting : kSettings)
+    {
+      for (int value = setting.minimum; value <= setting.maximum; value += setting.step)
+      {
+        allocations += CountAllocations([&] { m_engine.SetSetting(setting.name, value); });
+        allocations += CountAllocations([this] { Play(0.25); });
+      }
+    }
+
+    // Snapshots changing several settings at once, the largest grid and
+    // FFT first
+    SpectrumSettings settings;
+    settings.windowSize = 3;
+    settings.overlap = 3;
+    settings.channelMode = 1;
+    settings.outputDelay = 500;
+    allocations += CountAllocations([&] { m_engine.ApplySettings(settings); });
+    allocations += CountAllocations([this] { Play(0.5); });
+
+    uint32_t seed = 1;
+    for (int i = 0; i < 64; i++)
+    {
+      settings.ForEach([&](const char* name, int& value) {
+        for (const EngineSetting& setting : kSettings)
+        {
+          if (strcmp(setting.name, name) != 0)
+            continue;
+          seed = seed * 1664525u + 1013904223u;
+          const int steps = (setting.maximum - setting.minimum) / setting.step + 1;
+          value = setting.minimum + int((seed >> 16) % steps) * setting.step;
+        }
+      });
+      allocations += CountAllocations([&] { m_engine.ApplySettings(settings); });
+      allocations += CountAllocations([this] { Play(0.1); });
+    }
+
+    m_engine.StopOutputs();
+
+    printf("%d channels: %llu heap allocations, arena %zu of %zu bytes used, %zu bytes from the heap\n",
+           m_channels, static_cast<unsigned long long>(allocations), m_arena.Used(), m_arena.Capacity(),
+           m_arena.Overflow());
+    return allocations == 0 && m_arena.Overflow() == 0;
+  }
+
+private:
+  // Audio in blocks as Kodi hands it over and frames at 60 fps in between,
+  // for seconds of simulated time
+  void Play(double seconds)
+  {
+    const double end = m_now + seconds;
+    while (m_now < end)
+    {
+      for (int i = 0; i < kBlockFrames; i++, m_frame++)
+      {
+        const double t = double(m_frame) / kSampleRate;
+        const float value = static_cast<float>(0.5 * sin(2.0 * M_PI * (100.0 + 50.0 * fmod(t, 80.0)) * t));
+        for (int c = 0; c < m_channels; c++)
+          m_block[i * m_channels + c] = value * (c + 1) / m_channels;
+      }
+      m_now = double(m_frame) / kSampleRate;
+      m_engine.AudioData(m_block.data(), kBlockFrames * m_channels);
+
+      for (; m_nextFrame <= m_now; m_nextFrame += 1.0 / kFrameRate)
+        m_engine.Animate();
+    }
+  }
+
+  const int m_channels;
+  CArena m_arena;
+  CSpectrumEngine m_engine;
+  double m_now = 0.0;
+  double m_nextFrame = 0.0;
+  uint64_t m_frame = 0;
+  std::vector<float> m_block = std::vector<float>(kBlockFrames * 8);
+};
+
+} // namespace
+
+int main()
+{
+  bool ok = true;
+  for (int channels : { 1, 2, 6 })
+  {
+    CAllocationTest test(channels);
+    ok &= test.Run();
+  }
+
+  printf(ok ? "Allocations passed\n" : "Allocations FAILED\n");
+  return ok ? 0 : 1;
+}
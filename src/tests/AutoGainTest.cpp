@@ -0,0 +1,128 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+// Convergence of the automatic gain control on synthetic band levels at the
+// default analysis frame rate: after a level change the high percentile of
+// the gained bands has to settle at the target level within a given time
+// and stay there, louder music has to be followed faster than quieter, the
+// gain has to stay within its limits and hold through silence.
+
+#include "../AutoGain.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+
+const double kFrameRate = 44100.0 / 512.0;
+const int kBands = 32;
+
+// Allowed distance of the gained percentile from the target in octaves,
+// about 1.5 dB
+const float kTolerance = 0.25f;
+
+class CBandSource
+{
+public:
+  // Band levels spread evenly over one octave around level, in octaves
+  // below full scale, so the percentile is known
+  void Next(float level, float* bands)
+  {
+    for (int i = 0; i < kBands; i++)
+    {
+      m_seed = m_seed * 1664525u + 1013904223u;
+      const float spread = float(m_seed >> 8) / float(1u << 24) * 2.0f - 1.0f;
+      bands[i] = exp2f(level + spread);
+    }
+  }
+
+  static float Percentile(float level) { return level + 2.0f * CAutoGain::kPercentile - 1.0f; }
+
+private:
+  uint32_t m_seed = 1;
+};
+
+// Runs level for seconds and returns the time after which the gained
+// percentile stayed within the tolerance of the target, or -1
+double Settle(CAutoGain& gain, CBandSource& source, float level, double seconds)
+{
+  float bands[kBands];
+  double settled = -1.0;
+  const int frames = static_cast<int>(seconds * kFrameRate);
+  for (int frame = 0; frame < frames; frame++)
+  {
+    source.Next(level, bands);
+    const float gained = CBandSource::Percentile(level) + log2f(gain.Process(bands, kBands));
+    if (fabsf(gained - CAutoGain::kTargetLevel) > kTolerance)
+      settled = -1.0;
+    else if (settled < 0.0)
+      settled = frame / kFrameRate;
+  }
+  return settled;
+}
+
+bool Check(bool condition, const char* what)
+{
+  printf("%-56s %s\n", what, condition ? "ok" : "FAILED");
+  return condition;
+}
+
+bool CheckMode(CAutoGain::Mode mode, const char* name, double quieter, double louder)
+{
+  CAutoGain gain;
+  CBandSource source;
+  gain.Configure(mode, kFrameRate);
+  printf("%s mode\n", name);
+
+  // -30 dB, then 24 dB louder, then back
+  const double toQuiet = Settle(gain, source, -5.0f, quieter * 2.0);
+  const double toLoud = Settle(gain, source, -1.0f, louder * 2.0);
+  const double back = Settle(gain, source, -5.0f, quieter * 2.0);
+  printf("  settled after %.2f s, %.2f s louder, %.2f s quieter again, gain %.1f dB\n", toQuiet, toLoud, back,
+         gain.GainDecibels());
+
+  bool ok = Check(toQuiet >= 0.0 && toQuiet <= quieter, "  quiet music is brought up in time");
+  ok &= Check(toLoud >= 0.0 && toLoud <= louder, "  louder music is brought down in time");
+  ok &= Check(back >= 0.0 && back <= quieter, "  quieter music is brought up again in time");
+  ok &= Check(toLoud < toQuiet, "  louder music is followed faster than quieter");
+
+  // Silence holds the gain
+  const float before = gain.GainDecibels();
+  float silence[kBands] = {};
+  for (int frame = 0; frame < 10 * kFrameRate; frame++)
+    gain.Process(silence, kBands);
+  ok &= Check(gain.GainDecibels() == before, "  silence holds the gain");
+
+  // Near silence and clipping levels hit the limits of -18 and +30 dB
+  Settle(gain, source, -15.0f, 60.0);
+  ok &= Check(fabsf(gain.GainDecibels() - 30.1f) < 0.5f, "  gain is limited to +30 dB");
+  Settle(gain, source, 4.0f, 10.0);
+  ok &= Check(fabsf(gain.GainDecibels() + 18.1f) < 0.5f, "  gain is limited to -18 dB");
+  return ok;
+}
+
+} // namespace
+
+int main()
+{
+  CAutoGain off;
+  float bands[kBands];
+  CBandSource source;
+  source.Next(-5.0f, bands);
+  off.Configure(CAutoGain::kOff, kFrameRate);
+  bool ok = Check(off.Process(bands, kBands) == 1.0f && off.GainDecibels() == 0.0f, "off mode keeps unity gain");
+
+  ok &= CheckMode(CAutoGain::kSlow, "slow", 12.0, 2.0);
+  ok &= CheckMode(CAutoGain::kFast, "fast", 4.0, 0.75);
+
+  printf(ok ? "Auto gain passed\n" : "Auto gain FAILED\n");
+  return ok ? 0 : 1;
+}
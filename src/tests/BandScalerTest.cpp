@@ -0,0 +1,115 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+// Error bound of the table based log2 of the band scaler over magnitudes
+// from 1e-6 to 16, and the heights of every curve against the formula it
+// stands for, evaluated in double precision.
+
+#include "../BandScaler.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+namespace
+{
+
+const double kMaxLog2Error = 1e-5;
+const double kMaxHeightError = 1e-4;
+const int kBands = 64;
+const float kHeight = 2.0f;
+
+bool CheckLog2()
+{
+  double maxError = 0.0;
+  float worst = 0.0f;
+  for (int i = 0; i <= 1000000; i++)
+  {
+    const float x = static_cast<float>(1e-6 * pow(16e6, i / 1e6));
+    const double error = fabs(CBandScaler::Log2(x) - log2(double(x)));
+    if (error > maxError)
+    {
+      maxError = error;
+      worst = x;
+    }
+  }
+
+  printf("log2: max error %.2e at %g, bound %.0e\n", maxError, worst, kMaxLog2Error);
+  return maxError <= kMaxLog2Error;
+}
+
+double Expected(CBandScaler::Curve curve, double magnitude)
+{
+  switch (curve)
+  {
+    case CBandScaler::kLinear:
+      return magnitude * kHeight;
+
+    case CBandScaler::kDecibel:
+    case CBandScaler::kAWeighted:
+    {
+      // Bands at 1 kHz, where the A-weighting is 0 dB
+      const double db = magnitude > 0.0 ? 20.0 * log10(magnitude) : -1000.0;
+      const double range = CBandScaler::kDecibelCeiling - CBandScaler::kDecibelFloor;
+      return std::min(std::max((db - CBandScaler::kDecibelFloor) / range, 0.0), 1.0) * kHeight;
+    }
+
+    case CBandScaler::kLogarithmic:
+    default:
+    {
+      const double y = magnitude * 255.0;
+      return y > 1.0 ? log(y) / log(256.0) * kHeight : 0.0;
+    }
+  }
+}
+
+bool CheckCurve(CBandScaler::Curve curve, const char* name)
+{
+  CBandScaler scaler;
+  scaler.Configure(curve, kHeight, kBands);
+  for (int i = 0; i < kBands; i++)
+    scaler.SetBandFrequency(i, 1000.0f);
+
+  float magnitudes[kBands];
+  float heights[kBands];
+  float gained[kBands];
+  double maxError = 0.0;
+  for (int step = 0; step < 1000; step++)
+  {
+    // 0 and magnitudes from 1e-4 to 4
+    for (int i = 0; i < kBands; i++)
+    {
+      const int n = step * kBands + i;
+      magnitudes[i] = n ? static_cast<float>(1e-4 * pow(4e4, (n % 9973) / 9972.0)) : 0.0f;
+    }
+    scaler.Apply(magnitudes, heights);
+    for (int i = 0; i < kBands; i++)
+      maxError = std::max(maxError, fabs(heights[i] - Expected(curve, magnitudes[i])));
+
+    // A gain is the same as scaled magnitudes
+    scaler.Apply(magnitudes, gained, 0.5f);
+    for (int i = 0; i < kBands; i++)
+      maxError = std::max(maxError, fabs(gained[i] - Expected(curve, magnitudes[i] * 0.5)));
+  }
+
+  printf("%-12s max height error %.2e, bound %.0e\n", name, maxError, kMaxHeightError);
+  return maxError <= kMaxHeightError;
+}
+
+} // namespace
+
+int main()
+{
+  bool ok = CheckLog2();
+  ok &= CheckCurve(CBandScaler::kLogarithmic, "logarithmic");
+  ok &= CheckCurve(CBandScaler::kLinear, "linear");
+  ok &= CheckCurve(CBandScaler::kDecibel, "decibel");
+  ok &= CheckCurve(CBandScaler::kAWeighted, "a-weighted");
+
+  printf(ok ? "Band scaling passed\n" : "Band scaling FAILED\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+// Round trip of a capture recorded while settings change during audio, as
+// in Kodi: one thread hands audio to the engine while another records and
+// applies setting changes. Reading the file back has to give every audio
+// buffer and every setting whole and bit exact, in the order each thread
+// made them. A capture stopped while audio is still arriving has to end
+// after a whole record.
+
+#include "../Capture.h"
+#include "../SpectrumEngine.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+const char* kPath = "capture-test.spcp";
+const int kChannels = 2;
+const int kBlockFrames = 512;
+const int kBlocks = 400;
+const int kSettings = 200;
+
+// Sample i of block, distinct for every block
+float Sample(int block, int i)
+{
+  return static_cast<float>(block * 0.001 + i * 1e-6) * (i & 1 ? -1.0f : 1.0f);
+}
+
+const char* SettingName(int i)
+{
+  static const char* names[] = { "bar_height", "scaling", "speed", "overlap", "channel_mode", "auto_gain" };
+  return names[i % 6];
+}
+
+int SettingValue(int i)
+{
+  return (i / 6) % 3;
+}
+
+bool Record()
+{
+  CSpectrumEngine engine(16, 16);
+  if (!engine.StartCapture(kPath))
+  {
+    fprintf(stderr, "Failed to open %s\n", kPath);
+    return false;
+  }
+  engine.Start(kChannels, 44100, 16, "Capture test");
+
+  std::thread audio([&engine] {
+    std::vector<float> samples(kBlockFrames * kChannels);
+    for (int block = 0; block < kBlocks; block++)
+    {
+      for (size_t i = 0; i < samples.size(); i++)
+        samples[i] = Sample(block, int(i));
+      engine.AudioData(samples.data(), samples.size());
+    }
+  });
+
+  std::thread settings([&engine] {
+    for (int i = 0; i < kSettings; i++)
+    {
+      engine.RecordSetting(SettingName(i), SettingValue(i));
+      engine.SetSetting(SettingName(i), SettingValue(i));
+      std::this_thread::yield();
+    }
+  });
+
+  audio.join();
+  settings.join();
+  engine.StopCapture();
+  return true;
+}
+
+bool Verify()
+{
+  CCaptureReader reader;
+  if (!reader.Open(kPath))
+  {
+    fprintf(stderr, "Failed to read back %s\n", kPath);
+    return false;
+  }
+
+  CaptureRecord record;
+  int starts = 0;
+  int blocks = 0;
+  int settings = 0;
+  bool ok = true;
+  while (reader.Next(record))
+  {
+    if (record.type == CAPTURE_START)
+    {
+      ok &= record.channels == kChannels && record.samplesPerSec == 44100 && record.name == "Capture test";
+      starts++;
+    }
+    else if (record.type == CAPTURE_AUDIO)
+    {
+      bool intact = record.samples.size() == size_t(kBlockFrames * kChannels);
+      for (size_t i = 0; intact && i < record.samples.size(); i++)
+      {
+        const float expected = Sample(blocks, int(i));
+        intact = memcmp(&record.samples[i], &expected, sizeof(float)) == 0;
+      }
+      if (!intact && ok)
+        printf("Audio buffer %d is not intact\n", blocks);
+      ok &= intact;
+      blocks++;
+    }
+    else if (record.type == CAPTURE_SETTING)
+    {
+      const bool intact = record.name == SettingName(settings) && record.value == SettingValue(settings);
+      if (!intact && ok)
+        printf("Setting %d is %s = %d\n", settings, record.name.c_str(), record.value);
+      ok &= intact;
+      settings++;
+    }
+  }
+
+  printf("Read back %d start, %d of %d audio buffers, %d of %d settings\n", starts, blocks, kBlocks, settings,
+         kSettings);
+  return ok && starts == 1 && blocks == kBlocks && settings == kSettings;
+}
+
+// Stopping while the audio thread is in the middle of writing
+bool StopDuringAudio()
+{
+  CSpectrumEngine engine(16, 16);
+  if (!engine.StartCapture(kPath))
+    return false;
+  engine.Start(kChannels, 44100, 16, "Capture test");
+
+  std::atomic<bool> stop{false};
+  std::atomic<int> written{0};
+  std::thread audio([&] {
+    std::vector<float> samples(kBlockFrames * kChannels);
+    for (int block = 0; !stop; block++)
+    {
+      for (size_t i = 0; i < samples.size(); i++)
+        samples[i] = Sample(block, int(i));
+      engine.AudioData(samples.data(), samples.size());
+      written++;
+    }
+  });
+
+  while (written < 50)
+    std::this_thread::yield();
+  engine.StopCapture();
+  stop = true;
+  audio.join();
+
+  // The file holds whole records up to where it was closed and no more
+  CCaptureReader reader;
+  CaptureRecord record;
+  int blocks = 0;
+  if (!reader.Open(kPath))
+    return false;
+  while (reader.Next(record))
+    blocks += record.type == CAPTURE_AUDIO;
+
+  FILE* file = fopen(kPath, "rb");
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fclose(file);
+  const long expected = 8 + (9 + 12 + 4 + 12) + blocks * long(9 + kBlockFrames * kChannels * sizeof(float));
+
+  printf("Stopped after %d audio buffers, %d of them written, file of %ld bytes\n", written.load(), blocks, size);
+  return blocks >= 50 && size == expected;
+}
+
+} // namespace
+
+int main()
+{
+  bool ok = Record() && Verify();
+  ok &= StopDuringAudio();
+  remove(kPath);
+
+  printf(ok ? "Capture passed\n" : "Capture FAILED\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+// Round trip of rows published to shared memory, read back by a reader of
+// their own. Far more rows are published than the ring holds, so every slot
+// is reused many times: the newest rows have to read back bit exact, rows
+// already overwritten or not published yet have to be refused, and rows
+// longer than the writer was opened for have to be cut. Readers have to
+// see the writer stop, and a new writer under the same name must not be
+// mistaken for the old one.
+
+#include "../SpectrumExport.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+
+const char kName[] = "/kodi-visualization-spectrum-test";
+const int kMaxCols = 8;
+const uint32_t kRows = 1000;
+
+// Exit code telling ctest the test was skipped, without shared memory
+const int kSkipped = 77;
+
+// Up to kMaxCols + 3 heights, so some rows get cut
+int Cols(uint32_t row)
+{
+  return 1 + row % (kMaxCols + 3);
+}
+
+float Height(uint32_t row, int col)
+{
+  return row * 0.25f + col;
+}
+
+double Timestamp(uint32_t row)
+{
+  return row / 86.0;
+}
+
+// The row as it has to read back
+bool Intact(const CSpectrumExportReader& reader, uint32_t row)
+{
+  double timestamp = 0.0;
+  std::vector<float> heights;
+  if (!reader.Read(row, timestamp, heights) || timestamp != Timestamp(row) ||
+      heights.size() != static_cast<size_t>(std::min(Cols(row), kMaxCols)))
+    return false;
+
+  for (size_t i = 0; i < heights.size(); i++)
+  {
+    if (heights[i] != Height(row, static_cast<int>(i)))
+      return false;
+  }
+  return true;
+}
+
+bool Refused(const CSpectrumExportReader& reader, uint32_t row)
+{
+  double timestamp = 0.0;
+  std::vector<float> heights;
+  return !reader.Read(row, timestamp, heights);
+}
+
+} // namespace
+
+int main()
+{
+  CSpectrumExportWriter writer;
+  if (!writer.Open(kName, kMaxCols))
+  {
+    printf("No shared memory available, skipped\n");
+    return kSkipped;
+  }
+
+  CSpectrumExportReader reader;
+  bool ok = reader.Open(kName) && reader.IsLive() && reader.Rows() == 0 && Refused(reader, 0);
+
+  // Every row reads back right after it was published, the next one not yet
+  float row[kMaxCols + 3];
+  uint32_t failures = 0;
+  for (uint32_t i = 0; i < kRows; i++)
+  {
+    for (int col = 0; col < Cols(i); col++)
+      row[col] = Height(i, col);
+    writer.Publish(Timestamp(i), row, Cols(i));
+    failures += !Intact(reader, i) || !Refused(reader, i + 1);
+  }
+  ok &= failures == 0 && reader.Rows() == kRows && writer.Rows() == kRows;
+
+  // The ring keeps the newest rows, one contiguous run up to the last
+  uint32_t kept = 0;
+  while (kept < kRows && Intact(reader, kRows - 1 - kept))
+    kept++;
+  uint32_t refused = 0;
+  for (uint32_t i = 0; i < kRows - kept; i++)
+    refused += Refused(reader, i);
+  ok &= kept > 0 && kept < kRows && refused == kRows - kept;
+
+  printf("%u rows through a ring of %u slots, %u not read back right after publishing, %u of the %u "
+         "overwritten refused\n",
+         kRows, kept, failures, refused, kRows - kept);
+
+  // A stopped writer is seen, also once a new one took over the name
+  writer.Close();
+  const bool stopped = !reader.IsLive();
+  CSpectrumExportWriter next;
+  CSpectrumExportReader nextReader;
+  const bool reopened =
+      next.Open(kName, kMaxCols) && !reader.IsLive() && nextReader.Open(kName) && nextReader.IsLive() &&
+      nextReader.Rows() == 0;
+  next.Close();
+  ok &= stopped && reopened;
+  printf("writer stop %s, new writer %s\n", stopped ? "seen" : "NOT seen", reopened ? "separate" : "NOT separate");
+
+  printf(ok ? "Export passed\n" : "Export FAILED\n");
+  return ok ? 0 : 1;
+}
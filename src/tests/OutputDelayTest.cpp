@@ -0,0 +1,140 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+// Bars have to rise when the audio they were analysed from is heard.
+// Silence followed by a tone is played on a simulated clock, with Kodi
+// handing over every buffer as it is played, and the frame at which a bar
+// has risen to a quarter of the full height is taken, the point the engine
+// aims its timing at. With an output delay longer than the engine's own
+// latency the tone is heard that much later, and the bar has to rise at
+// the same offset from it for every delay, both when the row queue covers
+// all of the delay and when Kodi holds back the buffers asked for by
+// SyncDelay(). Without a delay it has to rise within the latency the engine
+// reports. No row may be shown early for lack of queue space.
+
+#include "../SpectrumEngine.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+
+// Kodi hands over 512 samples at a time
+const int kChannels = 2;
+const int kBlockFrames = 256;
+const double kFrameRate = 60.0;
+const double kToneStart = 1.0;
+const double kDuration = 2.5;
+
+// Shown delays may be off by up to a frame and a buffer from rounding to
+// the frame and buffer the row falls into
+const double kTolerance = 1.0 / kFrameRate + 0.5 * kBlockFrames / 44100.0;
+
+struct Result
+{
+  double risen = -1.0;
+  double latency = 0.0;
+  int syncBuffers = 0;
+  uint64_t earlyRows = 0;
+};
+
+// Time at which a bar has risen for the tone, played at sampleRate with the
+// given output delay, Kodi holding back SyncDelay() buffers if asked to
+Result Play(int sampleRate, int outputDelayMs, bool holdBack)
+{
+  double now = 0.0;
+  CSpectrumEngine engine(16, 16);
+  engine.SetClock([&now] { return now; });
+  engine.Start(kChannels, sampleRate, 16, "Output delay test");
+  engine.SetSetting("output_delay", outputDelayMs);
+
+  Result result;
+  result.latency = engine.Latency();
+  if (holdBack)
+    result.syncBuffers = engine.SyncDelay();
+  const double heldBack = result.syncBuffers * double(kBlockFrames) / sampleRate;
+
+  std::vector<float> block(kBlockFrames * kChannels);
+  uint64_t delivered = 0;
+  for (int frame = 0; frame < int(kDuration * kFrameRate); frame++)
+  {
+    // Every buffer that has finished playing by now, later by as many
+    // buffers as Kodi holds back
+    const double frameTime = frame / kFrameRate;
+    while (double(delivered + kBlockFrames) / sampleRate + heldBack <= frameTime)
+    {
+      for (int i = 0; i < kBlockFrames; i++)
+      {
+        const double t = double(delivered + i) / sampleRate;
+        const float sample = t >= kToneStart ? static_cast<float>(0.5 * sin(2.0 * M_PI * 440.0 * t)) : 0.0f;
+        for (int c = 0; c < kChannels; c++)
+          block[i * kChannels + c] = sample;
+      }
+      delivered += kBlockFrames;
+      now = double(delivered) / sampleRate + heldBack;
+      engine.AudioData(block.data(), block.size());
+    }
+
+    now = frameTime;
+    engine.Animate();
+    const CBarHeights& bars = engine.Bars();
+    if (result.risen < 0.0 && bars.Count() &&
+        *std::max_element(bars.Current(), bars.Current() + bars.Cols()) >= 0.25f * engine.FullHeight())
+      result.risen = frameTime;
+  }
+
+  result.earlyRows = engine.EarlyRows();
+  return result;
+}
+
+bool Check(int sampleRate)
+{
+  const Result immediate = Play(sampleRate, 0, false);
+  const double risen = immediate.risen - kToneStart;
+  bool ok = immediate.risen >= 0.0 && risen <= immediate.latency + kTolerance && immediate.earlyRows == 0;
+  printf("%6d Hz: no output delay, risen %5.1f ms after the tone, latency %5.1f ms %s\n", sampleRate,
+         risen * 1000.0, immediate.latency * 1000.0, ok ? "ok" : "FAILED");
+
+  // Offset of the bar from the delayed tone, the same for every delay
+  double reference = 0.0;
+  bool first = true;
+  for (int delayMs : { 200, 300, 500 })
+  {
+    for (bool holdBack : { false, true })
+    {
+      const Result delayed = Play(sampleRate, delayMs, holdBack);
+      const double offset = delayed.risen - kToneStart - delayMs / 1000.0;
+      if (first)
+        reference = offset;
+      first = false;
+
+      const bool delayOk = delayed.risen >= 0.0 && fabs(offset) <= delayed.latency &&
+                           fabs(offset - reference) <= kTolerance && delayed.earlyRows == 0;
+      printf("%6d Hz: output delay %3d ms, %2d buffers held back: risen %5.1f ms from the heard tone, %llu rows "
+             "early %s\n",
+             sampleRate, delayMs, delayed.syncBuffers, offset * 1000.0,
+             static_cast<unsigned long long>(delayed.earlyRows), delayOk ? "ok" : "FAILED");
+      ok &= delayOk;
+    }
+  }
+  return ok;
+}
+
+} // namespace
+
+int main()
+{
+  bool ok = Check(44100);
+  ok &= Check(48000);
+  ok &= Check(96000);
+
+  printf(ok ? "Output delay passed\n" : "Output delay FAILED\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,481 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+// Renders the OpenGL visualization without Kodi through EGL, on Mesa's
+// software rasterizer (llvmpipe) in CI, with the add-on's own shaders and
+// the test doubles of kodi/ in place of Kodi. Every case drives the add-on
+// through the same synthetic audio as Kodi would, on a simulated clock at
+// 60 frames per second and with every frame prepared inline, so the images
+// only depend on the code. The last frame is compared against the golden
+// image of the case, and the time per Render() is reported. The bars are
+// further drawn in plain grid order to check that drawing them front to
+// back lets fewer fragments pass the depth test.
+//
+// Usage: spectrum-test-Render <golden dir> [--update]
+//
+// --update writes the golden images instead of comparing. Every rendered
+// frame is also written to the working directory as render-<case>.ppm to
+// look at when a comparison fails.
+//
+// Built with SPECTRUM_STATIC_ALLOCATION the add-on must further not
+// allocate from the heap after Start(), while rendering and while every
+// setting is changed through all its values between frames.
+
+#include "../opengl_spectrum.cpp"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#ifdef SPECTRUM_STATIC_ALLOCATION
+#include "../tools/AllocationCounter.h"
+#endif
+
+namespace
+{
+
+const int kWidth = 160;
+const int kHeight = 120;
+const int kChannels = 2;
+const int kSampleRate = 44100;
+const int kBlockFrames = 1024;
+const int kFrames = 120;
+const double kFrameRate = 60.0;
+
+// A pixel differs if one of its channels is off by more than
+// kPixelTolerance, which rasterization and float rounding differences
+// between GL drivers and GLM versions stay within on all but a few edge
+// pixels. Up to kMaxDifferingPixels of the image may differ.
+const int kPixelTolerance = 48;
+const double kMaxDifferingPixels = 0.01;
+
+// Kodi's skin behind the visualization
+const GLfloat kBackground[4] = { 0.2f, 0.3f, 0.4f, 1.0f };
+
+// Exit code telling ctest the test was skipped, without a usable EGL
+const int kSkipped = 77;
+
+struct RenderCase
+{
+  const char* name;
+  std::map<std::string, std::string> settings;
+};
+
+const RenderCase kCases[] = {
+  { "bars", {} },
+  { "wireframe", { { "mode", "1" } } },
+  { "points", { { "mode", "2" } } },
+  { "particles", { { "particles", "1" } } },
+  { "channels", { { "channel_mode", "1" }, { "beat_effect", "2" } } },
+  { "half_scale", { { "render_scale", "3" } } },
+};
+
+#ifdef SPECTRUM_STATIC_ALLOCATION
+struct SettingRange
+{
+  const char* name;
+  int minimum;
+  int maximum;
+  int step;
+};
+
+// The integer settings with their values from settings.xml, the steps of the
+// sliders coarser
+const SettingRange kSettingRanges[] = {
+  { "mode", 0, 2, 1 },
+  { "particles", 0, 1, 1 },
+  { "pointsize", 1, 50, 7 },
+  { "bar_height", 0, 3, 1 },
+  { "scaling", 0, 3, 1 },
+  { "auto_gain", 0, 2, 1 },
+  { "speed", 0, 3, 1 },
+  { "rotation_angle", -15, 360, 75 },
+  { "beat_effect", 0, 3, 1 },
+  { "render_scale", 0, 3, 1 },
+  { "channel_mode", 0, 2, 1 },
+  { "window_size", 0, 3, 1 },
+  { "overlap", 0, 3, 1 },
+  { "output_delay", 0, 500, 100 },
+};
+#endif
+
+// Tones sweeping through the bands, a kick at 120 BPM and some noise, the
+// right channel a little different from the left
+class CSignal
+{
+public:
+  void Next(float* samples, int frames)
+  {
+    for (int i = 0; i < frames; i++, m_frame++)
+    {
+      const double t = double(m_frame) / kSampleRate;
+      const double sinceKick = fmod(t, 0.5);
+      const double sweep = 100.0 * pow(2.0, fmod(t * 2.0, 7.0));
+      double value = 0.6 * exp(-sinceKick * 10.0) * sin(2.0 * M_PI * 60.0 * sinceKick);
+      value += 0.2 * sin(2.0 * M_PI * sweep * t);
+      value += 0.1 * sin(2.0 * M_PI * 3000.0 * t) * (0.5 + 0.5 * sin(2.0 * M_PI * 0.7 * t));
+
+      m_seed = m_seed * 1664525u + 1013904223u;
+      const double noise = 0.02 * (double(m_seed >> 8) / double(1u << 24) - 0.5);
+
+      samples[i * kChannels] = static_cast<float>(value + noise);
+      samples[i * kChannels + 1] = static_cast<float>(0.7 * value - noise + 0.1 * sin(2.0 * M_PI * 440.0 * t));
+    }
+  }
+
+private:
+  uint64_t m_frame = 0;
+  uint32_t m_seed = 1;
+};
+
+class CEglContext
+{
+public:
+  ~CEglContext()
+  {
+    if (m_display == EGL_NO_DISPLAY)
+      return;
+    eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (m_context != EGL_NO_CONTEXT)
+      eglDestroyContext(m_display, m_context);
+    if (m_surface != EGL_NO_SURFACE)
+      eglDestroySurface(m_display, m_surface);
+    eglTerminate(m_display);
+  }
+
+  // A desktop OpenGL 3.2 compatibility context, as Kodi creates, with a
+  // pbuffer of the test size as its framebuffer
+  bool Create()
+  {
+    // Mesa's surfaceless platform needs no display server
+    auto getPlatformDisplay =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (getPlatformDisplay)
+      m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (m_display == EGL_NO_DISPLAY)
+      m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, nullptr, nullptr))
+      return false;
+
+    const EGLint configAttributes[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+                                        EGL_DEPTH_SIZE, 24, EGL_NONE };
+    EGLConfig config;
+    EGLint configs = 0;
+    if (!eglChooseConfig(m_display, configAttributes, &config, 1, &configs) || !configs ||
+        !eglBindAPI(EGL_OPENGL_API))
+      return false;
+
+    const EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 2,
+                                         EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                         EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT, EGL_NONE };
+    m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, contextAttributes);
+    const EGLint surfaceAttributes[] = { EGL_WIDTH, kWidth, EGL_HEIGHT, kHeight, EGL_NONE };
+    m_surface = eglCreatePbufferSurface(m_display, config, surfaceAttributes);
+    return m_context != EGL_NO_CONTEXT && m_surface != EGL_NO_SURFACE &&
+           eglMakeCurrent(m_display, m_surface, m_surface, m_context);
+  }
+
+private:
+  EGLDisplay m_display = EGL_NO_DISPLAY;
+  EGLContext m_context = EGL_NO_CONTEXT;
+  EGLSurface m_surface = EGL_NO_SURFACE;
+};
+
+struct Image
+{
+  std::vector<uint8_t> pixels;
+
+  // Binary PPM, top row first
+  bool Read(const std::string& path)
+  {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+      return false;
+    int width = 0;
+    int height = 0;
+    int max = 0;
+    pixels.assign(kWidth * kHeight * 3, 0);
+    const bool ok = fscanf(file, "P6 %d %d %d", &width, &height, &max) == 3 && fgetc(file) != EOF &&
+                    width == kWidth && height == kHeight && max == 255 &&
+                    fread(pixels.data(), 1, pixels.size(), file) == pixels.size();
+    fclose(file);
+    return ok;
+  }
+
+  bool Write(const std::string& path) const
+  {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+      return false;
+    fprintf(file, "P6\n%d %d\n255\n", kWidth, kHeight);
+    const bool ok = fwrite(pixels.data(), 1, pixels.size(), file) == pixels.size();
+    return fclose(file) == 0 && ok;
+  }
+
+  void ReadFramebuffer()
+  {
+    std::vector<uint8_t> rows(kWidth * kHeight * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, kWidth, kHeight, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+    pixels.resize(rows.size());
+    for (int y = 0; y < kHeight; y++)
+      memcpy(&pixels[y * kWidth * 3], &rows[(kHeight - 1 - y) * kWidth * 3], kWidth * 3);
+  }
+};
+
+} // namespace
+
+class CRenderTest
+{
+public:
+  CRenderTest(const std::string& goldenDir, bool update) : m_goldenDir(goldenDir), m_update(update) {}
+
+  bool Run(const RenderCase& test)
+  {
+    std::map<std::string, std::string>& settings = kodi::addon::TestSettings();
+    const std::map<std::string, std::string> defaults = settings;
+    for (const auto& setting : test.settings)
+      settings[setting.first] = setting.second;
+
+    Image image;
+    double renderMs = 0.0;
+    const bool rendered = Render(image, renderMs);
+    settings = defaults;
+    if (!rendered)
+    {
+      printf("%-12s failed to start\n", test.name);
+      return false;
+    }
+
+    image.Write(std::string("render-") + test.name + ".ppm");
+    const std::string golden = m_goldenDir + "/" + test.name + ".ppm";
+    if (m_update)
+    {
+      printf("%-12s %6.2f ms/frame, golden image written\n", test.name, renderMs);
+      return image.Write(golden);
+    }
+
+    Image expected;
+    if (!expected.Read(golden))
+    {
+      printf("%-12s no golden image %s\n", test.name, golden.c_str());
+      return false;
+    }
+
+    size_t differing = 0;
+    double sum = 0.0;
+    for (size_t i = 0; i < image.pixels.size(); i += 3)
+    {
+      int maxDiff = 0;
+      for (size_t c = 0; c < 3; c++)
+      {
+        const int diff = abs(int(image.pixels[i + c]) - int(expected.pixels[i + c]));
+        maxDiff = std::max(maxDiff, diff);
+        sum += diff;
+      }
+      differing += maxDiff > kPixelTolerance;
+    }
+
+    const double share = double(differing) / (kWidth * kHeight);
+    const bool ok = share <= kMaxDifferingPixels;
+    printf("%-12s %6.2f ms/frame, %5.2f%% pixels differ, mean difference %.3f %s\n", test.name, renderMs,
+           share * 100.0, sum / image.pixels.size(), ok ? "ok" : "FAILED");
+    return ok;
+  }
+
+  // The default bars over the same frames in both draw orders, counting the
+  // fragments passing the depth test
+  bool CheckFragments()
+  {
+    double fragments[2] = {0.0, 0.0};
+    GLuint query = 0;
+    glGenQueries(1, &query);
+    for (int gridOrder = 0; gridOrder < 2; gridOrder++)
+    {
+      std::unique_ptr<CVisualizationSpectrum> vis = Start();
+      if (!vis)
+      {
+        printf("%-12s failed to start\n", "fragments");
+        glDeleteQueries(1, &query);
+        return false;
+      }
+
+      vis->m_gridOrder = gridOrder != 0;
+      for (int frame = 0; frame < kFrames; frame++)
+      {
+        glBeginQuery(GL_SAMPLES_PASSED, query);
+        Frame(*vis);
+        glEndQuery(GL_SAMPLES_PASSED);
+        GLuint samples = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+        fragments[gridOrder] += samples;
+      }
+      vis->Stop();
+    }
+    glDeleteQueries(1, &query);
+
+    const bool ok = fragments[0] < fragments[1] && glGetError() == GL_NO_ERROR;
+    printf("%-12s %.0f per frame front to back, %.0f in grid order %s\n", "fragments", fragments[0] / kFrames,
+           fragments[1] / kFrames, ok ? "ok" : "FAILED");
+    return ok;
+  }
+
+#ifdef SPECTRUM_STATIC_ALLOCATION
+  // Every value of every setting in turn, a few frames each, counting the
+  // heap allocations made by the add-on from the first frame on
+  bool CheckAllocations()
+  {
+    std::unique_ptr<CVisualizationSpectrum> vis = Start();
+    if (!vis)
+    {
+      printf("%-12s failed to start\n", "allocations");
+      return false;
+    }
+
+    // llvmpipe compiles shaders for new draw states as they come
+    g_countProgramAllocationsOnly = true;
+    uint64_t allocations = CountAllocations([&] { Frame(*vis); });
+    int changes = 0;
+    for (const SettingRange& range : kSettingRanges)
+    {
+      for (int value = range.minimum; value <= range.maximum + range.step; value += range.step)
+      {
+        // Back to the default after the last value
+        const kodi::addon::CSettingValue setting(value <= range.maximum
+                                                     ? std::to_string(value)
+                                                     : kodi::addon::TestSettings()[range.name]);
+        allocations += CountAllocations([&] { vis->SetSetting(range.name, setting); });
+        for (int frame = 0; frame < 4; frame++)
+          allocations += CountAllocations([&] { Frame(*vis); });
+        changes++;
+      }
+    }
+
+    vis->Stop();
+    const CArena& arena = vis->m_arena;
+    const bool ok = allocations == 0 && arena.Overflow() == 0 && glGetError() == GL_NO_ERROR;
+    printf("%-12s %d setting changes, %llu heap allocations, arena %zu of %zu bytes used, %zu bytes from the "
+           "heap %s\n",
+           "allocations", changes, static_cast<unsigned long long>(allocations), arena.Used(), arena.Capacity(),
+           arena.Overflow(), ok ? "ok" : "FAILED");
+    return ok;
+  }
+#endif
+
+private:
+  // Started as by Kodi, with every frame prepared inline on the simulated
+  // clock
+  std::unique_ptr<CVisualizationSpectrum> Start()
+  {
+    m_now = 0.0;
+    m_frame = 0;
+    m_delivered = 0;
+    m_signal = CSignal();
+    m_renderTime = std::chrono::steady_clock::duration::zero();
+
+    std::unique_ptr<CVisualizationSpectrum> vis(new CVisualizationSpectrum);
+    vis->m_engine.SetClock([this] { return m_now; });
+    if (!vis->Start(kChannels, kSampleRate, 16, "Render test"))
+      return nullptr;
+    // Without its thread the worker prepares every frame inline in Render()
+    vis->m_worker.Stop();
+
+    bool wantsFreq;
+    int syncDelay;
+    vis->GetInfo(wantsFreq, syncDelay);
+    glViewport(0, 0, kWidth, kHeight);
+    return vis;
+  }
+
+  // The audio played until the next frame, then the frame, adding the time
+  // Render() takes up to the finished image to m_renderTime
+  void Frame(CVisualizationSpectrum& vis)
+  {
+    const double frameTime = m_frame++ / kFrameRate;
+    while (double(m_delivered + kBlockFrames) / kSampleRate <= frameTime)
+    {
+      m_delivered += kBlockFrames;
+      m_now = double(m_delivered) / kSampleRate;
+      m_signal.Next(m_block, kBlockFrames);
+      vis.AudioData(m_block, kBlockFrames * kChannels);
+    }
+
+    // Kodi leaves blending on and the depth test off
+    m_now = frameTime;
+    glClearColor(kBackground[0], kBackground[1], kBackground[2], kBackground[3]);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    vis.Render();
+    glFinish();
+    m_renderTime += std::chrono::steady_clock::now() - start;
+  }
+
+  // Kodi's calls for kFrames frames, with the audio arriving in blocks as
+  // it would be played
+  bool Render(Image& image, double& renderMs)
+  {
+    std::unique_ptr<CVisualizationSpectrum> vis = Start();
+    if (!vis)
+      return false;
+
+    for (int frame = 0; frame < kFrames; frame++)
+      Frame(*vis);
+
+    image.ReadFramebuffer();
+    vis->Stop();
+    renderMs = std::chrono::duration<double, std::milli>(m_renderTime).count() / kFrames;
+    return glGetError() == GL_NO_ERROR;
+  }
+
+  const std::string m_goldenDir;
+  const bool m_update;
+  double m_now = 0.0;
+  int m_frame = 0;
+  uint64_t m_delivered = 0;
+  CSignal m_signal;
+  std::chrono::steady_clock::duration m_renderTime{};
+  float m_block[kBlockFrames * kChannels];
+};
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: %s <golden dir> [--update]\n", argv[0]);
+    return 1;
+  }
+
+  CEglContext context;
+  if (!context.Create())
+  {
+    printf("No EGL desktop OpenGL context available, skipped\n");
+    return kSkipped;
+  }
+  printf("%s, OpenGL %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+  if (!kodi::vfs::DirectoryExists(kodi::addon::GetUserPath()))
+    kodi::vfs::CreateDirectory(kodi::addon::GetUserPath());
+
+  CRenderTest test(argv[1], argc > 2 && strcmp(argv[2], "--update") == 0);
+  bool ok = true;
+  for (const RenderCase& renderCase : kCases)
+    ok &= test.Run(renderCase);
+  ok &= test.CheckFragments();
+#ifdef SPECTRUM_STATIC_ALLOCATION
+  ok &= test.CheckAllocations();
+#endif
+
+  printf(ok ? "Render passed\n" : "Render FAILED\n");
+  return ok ? 0 : 1;
+}
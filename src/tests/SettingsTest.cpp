@@ -0,0 +1,121 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+// A settings snapshot with a single changed setting has to rebuild only the
+// part of the engine that setting belongs to. Music with a steady kick is
+// played until the tempo is known and the automatic gain control has
+// settled, then one setting is changed through ApplySettings(). Only the
+// window size, the overlap and the channel mode may restart the analysis,
+// which forgets the tempo, and only the automatic gain mode may reset the
+// gain. Bar height, scaling, speed and output delay must keep both, as
+// must a snapshot without changes.
+
+#include "../Settings.h"
+#include "../SpectrumEngine.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+
+const int kChannels = 2;
+const int kSampleRate = 44100;
+const int kBlockFrames = 256;
+const double kFrameRate = 60.0;
+const double kWarmUp = 8.0;
+
+struct SettingChange
+{
+  const char* name;
+  int value;
+  bool restartsAnalysis;
+  bool resetsGain;
+};
+
+// Changed from the defaults of settings.xml, with the slow automatic gain
+const SettingChange kChanges[] = {
+  { "bar_height", 2, false, false },
+  { "scaling", 1, false, false },
+  { "speed", 0, false, false },
+  { "output_delay", 200, false, false },
+  { "auto_gain", 2, false, true },
+  { "window_size", 1, true, false },
+  { "overlap", 1, true, false },
+  { "channel_mode", 1, true, false },
+  // The value already set, nothing changes
+  { "auto_gain", 1, false, false },
+};
+
+// A quiet kick at 120 BPM over a quieter tone, so the gain has to rise
+void Play(CSpectrumEngine& engine, double& now, double seconds)
+{
+  std::vector<float> block(kBlockFrames * kChannels);
+  const uint64_t end = static_cast<uint64_t>((now + seconds) * kSampleRate);
+  uint64_t delivered = static_cast<uint64_t>(now * kSampleRate);
+  double nextFrame = now;
+  while (delivered + kBlockFrames <= end)
+  {
+    for (int i = 0; i < kBlockFrames; i++)
+    {
+      const double t = double(delivered + i) / kSampleRate;
+      const double sinceKick = fmod(t, 0.5);
+      const double kick = 0.1 * exp(-sinceKick * 12.0) * sin(2.0 * M_PI * 55.0 * sinceKick);
+      const double tone = 0.01 * sin(2.0 * M_PI * 880.0 * t);
+      for (int c = 0; c < kChannels; c++)
+        block[i * kChannels + c] = static_cast<float>(kick + tone);
+    }
+    delivered += kBlockFrames;
+    now = double(delivered) / kSampleRate;
+    engine.AudioData(block.data(), block.size());
+
+    while (nextFrame <= now)
+    {
+      engine.Animate();
+      nextFrame += 1.0 / kFrameRate;
+    }
+  }
+}
+
+bool Check(const SettingChange& change)
+{
+  double now = 0.0;
+  CSpectrumEngine engine(16, 16);
+  engine.SetClock([&now] { return now; });
+  engine.Start(kChannels, kSampleRate, 16, "Settings test");
+
+  SpectrumSettings settings;
+  settings.autoGain = 1;
+  engine.ApplySettings(settings);
+  Play(engine, now, kWarmUp);
+
+  const double tempo = engine.Tempo();
+  const float gain = engine.AutoGain();
+  settings.Set(change.name, change.value);
+  engine.ApplySettings(settings);
+  const bool restarted = engine.Tempo() != tempo;
+  const bool gainReset = engine.AutoGain() != gain;
+
+  const bool ok = tempo > 0.0 && gain != 0.0f && restarted == change.restartsAnalysis &&
+                  gainReset == change.resetsGain;
+  printf("%-12s %4d: analysis %-9s gain %-5s %s\n", change.name, change.value,
+         restarted ? "restarted" : "kept", gainReset ? "reset" : "kept", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+} // namespace
+
+int main()
+{
+  bool ok = true;
+  for (const SettingChange& change : kChanges)
+    ok &= Check(change);
+
+  printf(ok ? "Settings passed\n" : "Settings FAILED\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+// Test double of the parts of Kodi's add-on API the renderer uses, so it can
+// be driven by the render test without Kodi. Settings start out with the
+// defaults of resources/settings.xml, paths point into the source tree and
+// the build directory, see TestSettings().
+
+#include <map>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#define ATTR_DLL_LOCAL
+#define ADDONCREATOR(AddonClass)
+
+typedef enum ADDON_STATUS
+{
+  ADDON_STATUS_OK,
+  ADDON_STATUS_LOST_CONNECTION,
+  ADDON_STATUS_NEED_RESTART,
+  ADDON_STATUS_NEED_SETTINGS,
+  ADDON_STATUS_UNKNOWN,
+  ADDON_STATUS_PERMANENT_FAILURE,
+} ADDON_STATUS;
+
+typedef enum AddonLog
+{
+  ADDON_LOG_DEBUG,
+  ADDON_LOG_INFO,
+  ADDON_LOG_WARNING,
+  ADDON_LOG_ERROR,
+  ADDON_LOG_FATAL,
+} AddonLog;
+
+namespace kodi
+{
+
+// Warnings and errors go to stderr, the rest only with SPECTRUM_TEST_VERBOSE
+// set in the environment
+inline void Log(const AddonLog loglevel, const char* format, ...)
+{
+  static const bool verbose = getenv("SPECTRUM_TEST_VERBOSE") != nullptr;
+  if (loglevel < ADDON_LOG_WARNING && !verbose)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+namespace addon
+{
+
+class CSettingValue
+{
+public:
+  explicit CSettingValue(const std::string& settingValue) : str(settingValue) {}
+
+  bool empty() const { return str.empty(); }
+  std::string GetString() const { return str; }
+  int GetInt() const { return atoi(str.c_str()); }
+  bool GetBoolean() const { return str == "true" || atoi(str.c_str()) > 0; }
+
+private:
+  const std::string str;
+};
+
+// Current value of every setting as text, preset with the defaults of the
+// add-on's settings.xml
+inline std::map<std::string, std::string>& TestSettings()
+{
+  static std::map<std::string, std::string> settings = [] {
+    std::map<std::string, std::string> defaults;
+    FILE* file = fopen(SPECTRUM_ADDON_DIR "/resources/settings.xml", "r");
+    if (!file)
+      return defaults;
+
+    std::string xml;
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+      xml.append(buffer, length);
+    fclose(file);
+
+    // <setting id="name" ...> followed by its <default>value</default>
+    size_t pos = 0;
+    while ((pos = xml.find("<setting id=\"", pos)) != std::string::npos)
+    {
+      pos += 13;
+      const std::string id = xml.substr(pos, xml.find('"', pos) - pos);
+      const size_t next = xml.find("<setting id=\"", pos);
+      const size_t value = xml.find("<default>", pos);
+      if (value < next)
+        defaults[id] = xml.substr(value + 9, xml.find("</default>", value) - value - 9);
+    }
+    return defaults;
+  }();
+  return settings;
+}
+
+inline int GetSettingInt(const std::string& settingName, int defaultValue = 0)
+{
+  const auto it = TestSettings().find(settingName);
+  return it != TestSettings().end() ? CSettingValue(it->second).GetInt() : defaultValue;
+}
+
+inline bool GetSettingBoolean(const std::string& settingName, bool defaultValue = false)
+{
+  const auto it = TestSettings().find(settingName);
+  return it != TestSettings().end() ? CSettingValue(it->second).GetBoolean() : defaultValue;
+}
+
+inline std::string GetAddonPath(const std::string& append = "")
+{
+  return append.empty() ? SPECTRUM_ADDON_DIR : SPECTRUM_ADDON_DIR "/" + append;
+}
+
+inline std::string GetUserPath(const std::string& append = "")
+{
+  return append.empty() ? SPECTRUM_USER_DIR : SPECTRUM_USER_DIR "/" + append;
+}
+
+class IAddonInstance
+{
+public:
+  virtual ~IAddonInstance() = default;
+};
+
+class CAddonBase
+{
+public:
+  virtual ~CAddonBase() = default;
+
+  virtual ADDON_STATUS SetSetting(const std::string& /*settingName*/, const CSettingValue& /*settingValue*/)
+  {
+    return ADDON_STATUS_UNKNOWN;
+  }
+};
+
+} // namespace addon
+} // namespace kodi
@@ -0,0 +1,33 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+// Test double, see AddonBase.h
+
+#include "AddonBase.h"
+
+#include <sys/stat.h>
+
+namespace kodi
+{
+namespace vfs
+{
+
+inline bool DirectoryExists(const std::string& path)
+{
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+inline bool CreateDirectory(const std::string& path)
+{
+  return mkdir(path.c_str(), 0755) == 0;
+}
+
+} // namespace vfs
+} // namespace kodi
@@ -0,0 +1,41 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+// Test double, see AddonBase.h. The render test calls the instance directly
+// in Kodi's order and renders into the current GL context.
+
+#include "../AddonBase.h"
+
+#include <stddef.h>
+
+namespace kodi
+{
+namespace addon
+{
+
+class CInstanceVisualization : public IAddonInstance
+{
+public:
+  virtual bool Start(int /*channels*/, int /*samplesPerSec*/, int /*bitsPerSample*/, const std::string& /*songName*/)
+  {
+    return true;
+  }
+  virtual void Stop() {}
+  virtual void AudioData(const float* /*audioData*/, size_t /*audioDataLength*/) {}
+  virtual bool IsDirty() { return true; }
+  virtual void Render() {}
+  virtual void GetInfo(bool& wantsFreq, int& syncDelay)
+  {
+    wantsFreq = false;
+    syncDelay = 0;
+  }
+};
+
+} // namespace addon
+} // namespace kodi
@@ -0,0 +1,20 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+// Test double, see AddonBase.h. Desktop OpenGL only.
+
+#ifndef HAS_GL
+#define HAS_GL 1
+#endif
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#define GL_TYPE_STRING "GL"
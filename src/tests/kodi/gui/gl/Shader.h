@@ -0,0 +1,152 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+// Test double of Kodi's shader program helper, see AddonBase.h. Compiles
+// and links like the real one: the extra text is put around the source
+// read from the file, OnCompiledAndLinked() follows a successful link and
+// EnableShader() keeps the program only if OnEnabled() returns true.
+
+#include "GL.h"
+
+#include <stdio.h>
+#include <string>
+
+namespace kodi
+{
+namespace gui
+{
+namespace gl
+{
+
+class CShaderProgram
+{
+public:
+  CShaderProgram() = default;
+  virtual ~CShaderProgram() { Free(); }
+
+  bool LoadShaderFiles(const std::string& vert, const std::string& frag)
+  {
+    return Read(vert, m_vertexSource) && Read(frag, m_fragmentSource);
+  }
+
+  bool CompileAndLink(const std::string& vertexExtraBegin = "",
+                      const std::string& vertexExtraEnd = "",
+                      const std::string& fragmentExtraBegin = "",
+                      const std::string& fragmentExtraEnd = "")
+  {
+    Free();
+
+    const GLuint vertex = Compile(GL_VERTEX_SHADER, vertexExtraBegin + m_vertexSource + vertexExtraEnd);
+    const GLuint fragment = Compile(GL_FRAGMENT_SHADER, fragmentExtraBegin + m_fragmentSource + fragmentExtraEnd);
+    if (vertex && fragment)
+    {
+      m_program = glCreateProgram();
+      glAttachShader(m_program, vertex);
+      glAttachShader(m_program, fragment);
+      glLinkProgram(m_program);
+
+      GLint linked = GL_FALSE;
+      glGetProgramiv(m_program, GL_LINK_STATUS, &linked);
+      if (linked)
+      {
+        m_ok = true;
+        OnCompiledAndLinked();
+      }
+      else
+      {
+        char log[1024];
+        glGetProgramInfoLog(m_program, sizeof(log), nullptr, log);
+        fprintf(stderr, "Shader link failed: %s\n", log);
+      }
+    }
+
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+    return m_ok;
+  }
+
+  void EnableShader()
+  {
+    if (!m_ok)
+      return;
+    glUseProgram(m_program);
+    if (!OnEnabled())
+      glUseProgram(0);
+  }
+
+  void DisableShader()
+  {
+    if (!m_ok)
+      return;
+    glUseProgram(0);
+    OnDisabled();
+  }
+
+  bool ShaderOK() const { return m_ok; }
+  GLuint ProgramHandle() const { return m_program; }
+
+  virtual void OnCompiledAndLinked() {}
+  virtual bool OnEnabled() { return false; }
+  virtual void OnDisabled() {}
+
+private:
+  static bool Read(const std::string& path, std::string& source)
+  {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file)
+    {
+      fprintf(stderr, "Failed to open shader %s\n", path.c_str());
+      return false;
+    }
+    source.clear();
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+      source.append(buffer, length);
+    fclose(file);
+    return true;
+  }
+
+  static GLuint Compile(GLenum type, const std::string& source)
+  {
+    const GLuint shader = glCreateShader(type);
+    const char* text = source.c_str();
+    glShaderSource(shader, 1, &text, nullptr);
+    glCompileShader(shader);
+
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled)
+    {
+      char log[1024];
+      glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+      fprintf(stderr, "Shader compile failed: %s\n", log);
+      glDeleteShader(shader);
+      return 0;
+    }
+    return shader;
+  }
+
+  void Free()
+  {
+    if (m_program)
+      glDeleteProgram(m_program);
+    m_program = 0;
+    m_ok = false;
+  }
+
+  std::string m_vertexSource;
+  std::string m_fragmentSource;
+  GLuint m_program = 0;
+  bool m_ok = false;
+};
+
+} // namespace gl
+} // namespace gui
+} // namespace kodi
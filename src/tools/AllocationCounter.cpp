@@ -0,0 +1,108 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "AllocationCounter.h"
+
+#include <new>
+#include <stdlib.h>
+
+#if defined(__GLIBC__)
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <string.h>
+#endif
+
+std::atomic<bool> g_countAllocations{false};
+std::atomic<uint64_t> g_allocations{0};
+std::atomic<bool> g_countProgramAllocationsOnly{false};
+
+namespace
+{
+
+#if defined(__GLIBC__)
+thread_local bool t_tracing = false;
+
+// Whether the first caller of operator new outside the C++ runtime is in
+// the program itself. Frames 0 to 2 are this function, Count() and
+// operator new.
+__attribute__((noinline)) bool CalledByProgram()
+{
+  // Unwinding may allocate when it first loads libgcc
+  if (t_tracing)
+    return false;
+  t_tracing = true;
+
+  void* frames[16];
+  const int count = backtrace(frames, 16);
+  Dl_info program;
+  dladdr(reinterpret_cast<void*>(&CalledByProgram), &program);
+
+  bool called = true;
+  for (int i = 3; i < count; i++)
+  {
+    Dl_info info = {};
+    if (!dladdr(frames[i], &info) || !info.dli_fname || !strstr(info.dli_fname, "libstdc++"))
+    {
+      called = !info.dli_fbase || info.dli_fbase == program.dli_fbase;
+      break;
+    }
+  }
+
+  t_tracing = false;
+  return called;
+}
+#endif
+
+__attribute__((noinline)) void Count()
+{
+  if (!g_countAllocations)
+    return;
+#if defined(__GLIBC__)
+  if (g_countProgramAllocationsOnly && !CalledByProgram())
+    return;
+#endif
+  g_allocations++;
+}
+
+} // namespace
+
+void* operator new(size_t size)
+{
+  Count();
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+  Count();
+  const size_t align = static_cast<size_t>(alignment);
+  if (void* p = aligned_alloc(align, (size + align - 1) / align * align))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+  free(p);
+}
@@ -0,0 +1,34 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// Heap allocations made through the global operator new, on any thread,
+// while g_countAllocations is set. AllocationCounter.cpp replaces operator
+// new and delete of the program it is linked into.
+extern std::atomic<bool> g_countAllocations;
+extern std::atomic<uint64_t> g_allocations;
+
+// With glibc, leave out allocations made by shared libraries other than the
+// C++ runtime, e.g. by a GL driver compiling shaders while drawing. Only
+// what the program's own code allocates, directly or through the standard
+// library, is counted then.
+extern std::atomic<bool> g_countProgramAllocationsOnly;
+
+// Count the heap allocations made by func, returns their number
+template<typename F>
+uint64_t CountAllocations(F func)
+{
+  const uint64_t before = g_allocations;
+  g_countAllocations = true;
+  func();
+  g_countAllocations = false;
+  return g_allocations - before;
+}
@@ -0,0 +1,582 @@
+/*
+ *  Copyright (C) 2005-2022 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+// Headless replay of a session recorded with the "capture" setting. Drives
+// the spectrum engine with exactly the recorded Start(), AudioData() and
+// SetSetting() calls and reports where the time goes.
+//
+// With --golden the displayed bar heights of every simulated frame are
+// written to the given file, or compared against it if it already exists.
+// The tool then fails if any height differs by more than the tolerance, so
+// changes to the analysis and animation can be checked for visual changes.
+//
+// The beat detector is benchmarked on the recorded audio as well, with the
+// default analysis settings. --beats takes a text file of reference beat
+// times in seconds since the first Start() of the capture and reports how
+// many detected beats match one within 70 ms.
+//
+// --geometry benchmarks the per vertex height expansion of the OpenGL
+// renderer on grids of 16 to 128 columns.
+//
+// --auto-gain <mode> replays with the automatic gain control in the given
+// mode instead of the recorded one. The gain range and the mean bar height
+// are reported either way.
+//
+// --scaling checks the table based log2 of the band scaler against log2()
+// and times every curve against the former logf() per band. The tool fails
+// if the error exceeds its bound.
+//
+// --export <name> publishes the analysed rows to shared memory under the
+// given name while replaying, as the "shared_memory" setting does, and
+// reads the newest rows back at the end. Run with --realtime to watch the
+// stream from another process.
+//
+// --statistics <file> collects the display statistics of the "statistics"
+// setting over the replay and writes them to the given CSV file.
+//
+// Heap allocations made while the engine handles AudioData(), Animate() and
+// setting changes are counted. A build with SPECTRUM_STATIC_ALLOCATION must
+// not make any, nor outgrow its arena, and fails otherwise.
+//
+// Usage: spectrum-replay <capture.spcp> [--realtime] [--fps <frames per second>]
+//                        [--golden <file>] [--tolerance <max difference>]
+//                        [--beats <reference file>] [--geometry] [--scaling]
+//                        [--auto-gain <0 off, 1 slow, 2 fast>] [--export <name>]
+//                        [--statistics <file>]
+
+#include "../BandScaler.h"
+#include "../BeatDetector.h"
+#include "../Capture.h"
+#include "../SpectrumAnalyzer.h"
+#include "../SpectrumEngine.h"
+#include "../SpectrumExport.h"
+#include "../VertexHeights.h"
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Timing
+{
+  uint64_t calls = 0;
+  Clock::duration total = Clock::duration::zero();
+
+  template<typename F>
+  void Measure(F func)
+  {
+    const Clock::time_point start = Clock::now();
+    func();
+    total += Clock::now() - start;
+    calls++;
+  }
+
+  void Print(const char* name) const
+  {
+    const double us = std::chrono::duration<double, std::micro>(total).count();
+    printf("%-10s %10llu calls %12.1f us total %9.3f us/call\n", name,
+           static_cast<unsigned long long>(calls), us, calls ? us / calls : 0.0);
+  }
+};
+
+// Per frame dump of the displayed heights, one line of text per frame
+class CGoldenFrames
+{
+public:
+  ~CGoldenFrames()
+  {
+    if (m_file)
+      fclose(m_file);
+  }
+
+  bool Open(const char* path, float tolerance)
+  {
+    m_tolerance = tolerance;
+    m_file = fopen(path, "r");
+    m_compare = m_file != nullptr;
+    if (!m_file)
+      m_file = fopen(path, "w");
+    return m_file != nullptr;
+  }
+
+  void Frame(const CBarHeights& bars)
+  {
+    if (!m_file)
+      return;
+
+    for (size_t i = 0; i < bars.Count(); i++)
+    {
+      const float height = bars.Current()[i];
+      if (!m_compare)
+      {
+        fprintf(m_file, i ? " %.6f" : "%.6f", height);
+        continue;
+      }
+
+      float expected;
+      if (fscanf(m_file, "%f", &expected) != 1)
+      {
+        if (!m_mismatches++)
+          printf("Golden file ends before frame %llu\n", static_cast<unsigned long long>(m_frame));
+        fclose(m_file);
+        m_file = nullptr;
+        return;
+      }
+
+      const float diff = fabsf(expected - height);
+      m_maxDiff = diff > m_maxDiff ? diff : m_maxDiff;
+      if (diff > m_tolerance && !m_mismatches++)
+        printf("First mismatch in frame %llu, bar %zu: %f, expected %f\n",
+               static_cast<unsigned long long>(m_frame), i, height, expected);
+    }
+
+    if (!m_compare)
+      fputc('\n', m_file);
+    m_frame++;
+  }
+
+  // Returns false if the comparison failed
+  bool Report() const
+  {
+    if (!m_compare)
+    {
+      printf("Golden file written with %llu frames\n", static_cast<unsigned long long>(m_frame));
+      return true;
+    }
+
+    printf("Compared %llu frames, max difference %f, %llu mismatches\n",
+           static_cast<unsigned long long>(m_frame), m_maxDiff,
+           static_cast<unsigned long long>(m_mismatches));
+    return m_mismatches == 0;
+  }
+
+private:
+  FILE* m_file = nullptr;
+  bool m_compare = false;
+  float m_tolerance = 0.0f;
+  float m_maxDiff = 0.0f;
+  uint64_t m_frame = 0;
+  uint64_t m_mismatches = 0;
+};
+
+// Runs the beat detector alone over the recorded audio and compares the
+// beats found against the reference times if given
+bool BenchmarkBeats(const char* path, const char* referencePath)
+{
+  CCaptureReader reader;
+  if (!reader.Open(path))
+    return false;
+
+  CSpectrumAnalyzer analyzer;
+  CBeatDetector detector;
+  CaptureRecord record;
+  Timing timing;
+  std::vector<double> beats;
+  double streamOffset = 0.0;
+
+  while (reader.Next(record))
+  {
+    if (record.type == CAPTURE_START)
+    {
+      // Stream time starts again with every Start()
+      streamOffset += analyzer.StreamTime();
+      analyzer.Configure(record.channels, record.samplesPerSec, 2048, 512, 16, false);
+      detector.Reset(double(analyzer.SampleRate()) / analyzer.HopSize());
+    }
+    else if (record.type == CAPTURE_AUDIO)
+    {
+      const size_t frames = analyzer.Process(record.samples.data(), record.samples.size());
+      for (size_t f = 0; f < frames; f++)
+      {
+        const SpectrumFrame& frame = analyzer.Frame(f);
+        bool beat = false;
+        timing.Measure([&] { beat = detector.Process(frame.bands.data(), frame.bands.size(), frame.timestamp); });
+        if (beat)
+          beats.push_back(streamOffset + frame.timestamp);
+      }
+    }
+  }
+
+  printf("%zu beats, tempo %.1f BPM\n", beats.size(), detector.Tempo());
+  timing.Print("Beats");
+
+  if (!referencePath)
+    return true;
+
+  FILE* file = fopen(referencePath, "r");
+  if (!file)
+  {
+    fprintf(stderr, "Failed to open beat reference %s\n", referencePath);
+    return false;
+  }
+
+  std::vector<double> reference;
+  double time;
+  while (fscanf(file, "%lf", &time) == 1)
+    reference.push_back(time);
+  fclose(file);
+
+  // Every reference beat can be matched by one detected beat at most
+  const double window = 0.07;
+  std::vector<bool> used(reference.size(), false);
+  size_t hits = 0;
+  for (double beat : beats)
+  {
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+      if (!used[i] && fabs(reference[i] - beat) <= window)
+      {
+        used[i] = true;
+        hits++;
+        break;
+      }
+    }
+  }
+
+  const double precision = beats.empty() ? 0.0 : double(hits) / beats.size();
+  const double recall = reference.empty() ? 0.0 : double(hits) / reference.size();
+  const double fMeasure = precision + recall > 0.0 ? 2.0 * precision * recall / (precision + recall) : 0.0;
+  printf("Beat accuracy against %zu reference beats: precision %.3f, recall %.3f, F-measure %.3f\n",
+         reference.size(), precision, recall, fMeasure);
+  return true;
+}
+
+// Time per frame of the per vertex height expansion of the OpenGL renderer,
+// for 32 bit and half float heights
+void BenchmarkGeometry()
+{
+  const int kRows = 16;
+  const int kVertices = 48;
+  const int kFrames = 2000;
+
+  for (int cols : { 16, 64, 128 })
+  {
+    std::vector<float> heights(kRows * cols);
+    for (size_t i = 0; i < heights.size(); i++)
+      heights[i] = float((i * 7919) % 1000) / 1000.0f;
+    std::vector<float> vertices(heights.size() * kVertices);
+    std::vector<uint16_t> halfVertices(heights.size() * kVertices);
+
+    Timing full, half;
+    for (int frame = 0; frame < kFrames; frame++)
+    {
+      full.Measure([&] { ExpandHeights<kVertices>(vertices.data(), heights.data(), 0, heights.size()); });
+      half.Measure([&] { ExpandHeights<kVertices>(halfVertices.data(), heights.data(), 0, heights.size()); });
+    }
+
+    const double fullUs = std::chrono::duration<double, std::micro>(full.total).count() / kFrames;
+    const double halfUs = std::chrono::duration<double, std::micro>(half.total).count() / kFrames;
+    printf("Geometry %dx%d: %8.2f us/frame float, %8.2f us/frame half, %.2f ns per bar\n", kRows, cols, fullUs,
+           halfUs, halfUs * 1000.0 / heights.size());
+  }
+}
+
+// Error of CBandScaler::Log2() over magnitudes from 1e-6 to 16, and the
+// time to scale 256 bands with each curve next to the former
+// logf(y) * scale per band
+bool BenchmarkScaling()
+{
+  const double kMaxError = 1e-5;
+  const int kBands = 256;
+  const int kFrames = 20000;
+
+  double maxError = 0.0;
+  for (int i = 0; i <= 1000000; i++)
+  {
+    const float x = static_cast<float>(1e-6 * pow(16e6, i / 1e6));
+    maxError = std::max(maxError, fabs(CBandScaler::Log2(x) - log2(double(x))));
+  }
+  printf("Scaling log2 max error %.2e (bound %.0e)\n", maxError, kMaxError);
+
+  float magnitudes[kBands];
+  for (int i = 0; i < kBands; i++)
+    magnitudes[i] = float((i * 7919) % 1000) / 1000.0f;
+  float heights[kBands];
+
+  Timing reference;
+  const float scale = 1.0f / logf(256.0f);
+  for (int frame = 0; frame < kFrames; frame++)
+  {
+    reference.Measure([&] {
+      for (int i = 0; i < kBands; i++)
+      {
+        const float y = magnitudes[i] * 255.0f;
+        heights[i] = y > 1.0f ? logf(y) * scale : 0.0f;
+      }
+    });
+  }
+  const double referenceNs = std::chrono::duration<double, std::nano>(reference.total).count() / kFrames / kBands;
+  printf("Scaling %-12s %6.2f ns/band\n", "logf", referenceNs);
+
+  const char* names[] = { "logarithmic", "linear", "decibel", "a-weighted" };
+  for (int curve = CBandScaler::kLogarithmic; curve <= CBandScaler::kAWeighted; curve++)
+  {
+    CBandScaler scaler;
+    scaler.Configure(static_cast<CBandScaler::Curve>(curve), 1.0f, kBands);
+    for (int i = 0; i < kBands; i++)
+      scaler.SetBandFrequency(i, 20.0f * powf(1000.0f, float(i) / kBands));
+
+    Timing timing;
+    for (int frame = 0; frame < kFrames; frame++)
+      timing.Measure([&] { scaler.Apply(magnitudes, heights); });
+    const double ns = std::chrono::duration<double, std::nano>(timing.total).count() / kFrames / kBands;
+    printf("Scaling %-12s %6.2f ns/band, speedup %.2f\n", names[curve], ns, referenceNs / ns);
+  }
+
+  return maxError <= kMaxError;
+}
+
+// Read the rows still in the shared memory ring back as another process
+// would, they must all be intact and in stream order
+bool CheckExport(const char* name)
+{
+  CSpectrumExportReader reader;
+  if (!reader.Open(name) || !reader.IsLive())
+  {
+    fprintf(stderr, "Failed to open shared memory %s\n", name);
+    return false;
+  }
+
+  const uint32_t rows = reader.Rows();
+  const uint32_t first = rows > 64 ? rows - 64 : 0;
+  std::vector<float> heights;
+  double timestamp = 0.0;
+  double last = -1.0;
+  uint32_t read = 0;
+  for (uint32_t row = first; row < rows; row++, read++)
+  {
+    if (!reader.Read(row, timestamp, heights) || timestamp < last)
+    {
+      fprintf(stderr, "Shared memory row %u is not intact\n", row);
+      return false;
+    }
+    last = timestamp;
+  }
+
+  printf("Exported %u rows to %s, read back the last %u, newest at %.3f s with %zu heights\n", rows, name,
+         read, last, heights.size());
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const char* path = nullptr;
+  const char* goldenPath = nullptr;
+  const char* beatsPath = nullptr;
+  const char* exportName = nullptr;
+  const char* statisticsPath = nullptr;
+  bool realtime = false;
+  bool geometry = false;
+  bool scaling = false;
+  int autoGain = -1;
+  double fps = 60.0;
+  float tolerance = 1e-4f;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--realtime") == 0)
+      realtime = true;
+    else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+      fps = atof(argv[++i]);
+    else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+      goldenPath = argv[++i];
+    else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+      tolerance = static_cast<float>(atof(argv[++i]));
+    else if (strcmp(argv[i], "--beats") == 0 && i + 1 < argc)
+      beatsPath = argv[++i];
+    else if (strcmp(argv[i], "--geometry") == 0)
+      geometry = true;
+    else if (strcmp(argv[i], "--scaling") == 0)
+      scaling = true;
+    else if (strcmp(argv[i], "--auto-gain") == 0 && i + 1 < argc)
+      autoGain = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+      exportName = argv[++i];
+    else if (strcmp(argv[i], "--statistics") == 0 && i + 1 < argc)
+      statisticsPath = argv[++i];
+    else
+      path = argv[i];
+  }
+
+  if (!path || fps <= 0.0)
+  {
+    fprintf(stderr, "Usage: %s <capture.spcp> [--realtime] [--fps <frames per second>]"
+                    " [--golden <file>] [--tolerance <max difference>] [--beats <reference file>] [--geometry]"
+                    " [--scaling] [--auto-gain <mode>] [--export <name>] [--statistics <file>]\n",
+            argv[0]);
+    return 1;
+  }
+
+  CCaptureReader reader;
+  if (!reader.Open(path))
+  {
+    fprintf(stderr, "Failed to open capture file %s\n", path);
+    return 1;
+  }
+
+  CGoldenFrames golden;
+  if (goldenPath && !golden.Open(goldenPath, tolerance))
+  {
+    fprintf(stderr, "Failed to open golden file %s\n", goldenPath);
+    return 1;
+  }
+
+  CArena arena;
+  CSpectrumEngine engine(16, 16);
+  CaptureRecord record;
+  Timing audio, animate;
+  uint64_t settings = 0;
+  float minGain = 0.0f;
+  float maxGain = 0.0f;
+  double heightSum = 0.0;
+  uint64_t heightCount = 0;
+  uint64_t fullHeight = 0;
+
+  // Render frames are simulated on the recorded timeline, and the engine
+  // runs on that timeline too, so the result does not depend on how fast
+  // the replay runs
+  const uint64_t frameUs = static_cast<uint64_t>(1000000.0 / fps);
+  uint64_t nextFrameUs = 0;
+  uint64_t nowUs = 0;
+  engine.SetClock([&nowUs] { return nowUs / 1000000.0; });
+  const Clock::time_point startTime = Clock::now();
+
+  while (reader.Next(record))
+  {
+    for (; nextFrameUs <= record.timestampUs; nextFrameUs += frameUs)
+    {
+      nowUs = nextFrameUs;
+      animate.Measure([&] { CountAllocations([&] { engine.Animate(); }); });
+      golden.Frame(engine.Bars());
+
+      const CBarHeights& bars = engine.Bars();
+      const float full = engine.FullHeight();
+      for (size_t i = 0; i < bars.Count(); i++)
+      {
+        heightSum += bars.Current()[i];
+        fullHeight += bars.Current()[i] >= full;
+      }
+      heightCount += bars.Count();
+    }
+
+    if (realtime)
+      std::this_thread::sleep_until(startTime + std::chrono::microseconds(record.timestampUs));
+
+    nowUs = record.timestampUs;
+
+    switch (record.type)
+    {
+      case CAPTURE_START:
+        printf("Start: %d channels, %d Hz, %d bits, \"%s\"\n", record.channels,
+               record.samplesPerSec, record.bitsPerSample, record.name.c_str());
+#ifdef SPECTRUM_STATIC_ALLOCATION
+        arena.BeginMeasure();
+        engine.ReserveBuffers(arena, record.channels, record.samplesPerSec);
+        arena.Commit();
+        engine.ReserveBuffers(arena, record.channels, record.samplesPerSec);
+#endif
+        if (exportName && !engine.StartExport(exportName, record.channels))
+        {
+          fprintf(stderr, "Failed to create shared memory %s\n", exportName);
+          return 1;
+        }
+        if (statisticsPath && !engine.IsCollectingStatistics())
+          engine.StartStatistics(record.channels);
+        engine.Start(record.channels, record.samplesPerSec, record.bitsPerSample, record.name);
+        if (autoGain >= 0)
+          engine.SetAutoGainSetting(autoGain);
+        break;
+
+      case CAPTURE_AUDIO:
+        audio.Measure([&] { CountAllocations([&] { engine.AudioData(record.samples.data(), record.samples.size()); }); });
+        minGain = std::min(minGain, engine.AutoGain());
+        maxGain = std::max(maxGain, engine.AutoGain());
+        break;
+
+      case CAPTURE_SETTING:
+        if (autoGain < 0 || record.name != "auto_gain")
+          CountAllocations([&] { engine.SetSetting(record.name, record.value); });
+        settings++;
+        break;
+    }
+  }
+
+  // Checksum of the final state to compare replays of the same capture
+  double checksum = 0.0;
+  for (size_t i = 0; i < engine.Bars().Count(); i++)
+    checksum += engine.Bars().Current()[i] * (i + 1);
+
+  printf("Session length %.3f s, %llu setting changes\n", record.timestampUs / 1000000.0,
+         static_cast<unsigned long long>(settings));
+  audio.Print("AudioData");
+  animate.Print("Animate");
+  printf("Latency %.1f ms, %llu rows shown early with a full row queue\n", engine.Latency() * 1000.0,
+         static_cast<unsigned long long>(engine.EarlyRows()));
+  printf("Checksum %.6f\n", checksum);
+  printf("Auto gain %.1f to %.1f dB, mean bar height %.3f, %.1f%% at full height\n", minGain, maxGain,
+         heightCount ? heightSum / heightCount : 0.0, heightCount ? 100.0 * fullHeight / heightCount : 0.0);
+
+  CMemoryReport memory;
+  engine.ReportMemory(memory);
+  for (const CMemoryReport::Entry& entry : memory.Entries())
+    printf("Memory %-16s %9zu bytes\n", entry.subsystem.c_str(), entry.cpuBytes);
+  printf("Memory total %19zu bytes\n", memory.CpuBytes());
+#ifdef SPECTRUM_STATIC_ALLOCATION
+  printf("Memory arena %9zu of %9zu bytes used, %zu bytes from the heap\n", arena.Used(), arena.Capacity(),
+         arena.Overflow());
+#endif
+  printf("Heap allocations in AudioData/Animate/SetSetting: %llu\n",
+         static_cast<unsigned long long>(g_allocations.load()));
+
+  if (statisticsPath)
+  {
+    StatisticsSummary summary;
+    if (!engine.WriteStatistics(statisticsPath, summary))
+    {
+      fprintf(stderr, "Failed to write statistics file %s\n", statisticsPath);
+      return 1;
+    }
+    printf("Statistics of %llu rows over %.1f s: mean height %.3f, %.1f%% at full height, %.1f%% at zero\n",
+           static_cast<unsigned long long>(summary.rows), summary.seconds, summary.meanHeight,
+           summary.clipRate * 100.0, summary.zeroRate * 100.0);
+  }
+
+  if (exportName && !CheckExport(exportName))
+    return 5;
+  engine.StopExport();
+
+  if (!BenchmarkBeats(path, beatsPath))
+    return 1;
+
+  if (geometry)
+    BenchmarkGeometry();
+
+  if (scaling && !BenchmarkScaling())
+    return 4;
+
+  if (goldenPath && !golden.Report())
+    return 2;
+
+#ifdef SPECTRUM_STATIC_ALLOCATION
+  if (g_allocations || arena.Overflow())
+    return 3;
+#endif
+
+  return 0;
+}
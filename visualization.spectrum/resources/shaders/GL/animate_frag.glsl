@@ -0,0 +1,9 @@
+#version 150
+
+out vec4 FragColor;
+
+void main()
+{
+  // Never runs, the animation pass discards all primitives
+  FragColor = vec4(0.0);
+}
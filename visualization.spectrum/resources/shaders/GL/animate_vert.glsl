@@ -0,0 +1,15 @@
+#version 150
+
+uniform float u_speed;
+
+in float a_target;
+in float a_current;
+
+out float v_current;
+
+void main()
+{
+  // Same step as CBarHeights::Animate(), captured by transform feedback
+  v_current = a_current + clamp(a_target - a_current, -u_speed, u_speed);
+  gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+}
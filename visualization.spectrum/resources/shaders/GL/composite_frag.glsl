@@ -0,0 +1,13 @@
+#version 150
+
+uniform sampler2D u_texture;
+
+in vec2 v_texCoord;
+
+out vec4 FragColor;
+
+void main()
+{
+  // Premultiplied alpha, the target was cleared to transparent black
+  FragColor = texture(u_texture, v_texCoord);
+}
@@ -0,0 +1,12 @@
+#version 150
+
+in vec2 a_position;
+
+out vec2 v_texCoord;
+
+void main()
+{
+  // The quad covers the viewport, the texture spans it exactly
+  v_texCoord = a_position * 0.5 + 0.5;
+  gl_Position = vec4(a_position, 0.0, 1.0);
+}
@@ -1,6 +1,5 @@
-#version 150
-
-uniform float u_pointSize;
+// #version and the variant defines are prepended by CBarShader, see
+// vert.glsl
 
 in vec4 v_color;
 
@@ -8,11 +7,10 @@ out vec4 FragColor;
 
 void main()
 {
-  if (u_pointSize != 0.0)
-  {
-    vec2 coord = gl_PointCoord - vec2(0.5);  //from [0,1] to [-0.5,0.5]
-    if(length(coord) > 0.5)                  //outside of circle radius?
-      discard;
-  }
+#ifdef POINTS
+  vec2 coord = gl_PointCoord - vec2(0.5);  //from [0,1] to [-0.5,0.5]
+  if(length(coord) > 0.5)                  //outside of circle radius?
+    discard;
+#endif
   FragColor = v_color;
 }
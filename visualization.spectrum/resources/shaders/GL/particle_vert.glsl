@@ -0,0 +1,47 @@
+#version 150
+
+#define PARTICLE_BANDS 32
+
+uniform mat4 u_projectionMatrix;
+uniform mat4 u_modelViewMatrix;
+uniform float u_pointSize;
+uniform float u_time;
+uniform float u_energy[PARTICLE_BANDS];
+
+// band, phase, direction, energy needed to take part
+in vec4 a_seed;
+
+out vec4 v_color;
+
+// Must match CParticleSystem::kLifetime, u_time wraps around after it
+const float kLifetime = 1.5;
+const float kGravity = 3.0;
+
+void main()
+{
+  float energy = u_energy[int(a_seed.x)];
+
+  // Every particle restarts once per lifetime, the phase spreads the
+  // restarts over the pool. Louder bands let more particles take part and
+  // send them higher.
+  float age = fract(u_time / kLifetime + a_seed.y) * kLifetime;
+  float angle = a_seed.z * 6.2831853;
+  vec3 velocity = vec3(cos(angle) * 0.15, (0.8 + a_seed.w * 1.2) * (0.5 + energy), sin(angle) * 0.15);
+  vec3 origin = vec3(-1.6 + (a_seed.x + 0.5) * (3.2 / float(PARTICLE_BANDS)), 0.0, -1.6 + fract(a_seed.y * 7.0) * 3.2);
+  vec3 position = origin + velocity * age - vec3(0.0, 0.5 * kGravity * age * age, 0.0);
+
+  if (a_seed.w > energy || position.y < 0.0)
+  {
+    // Outside of the clip volume
+    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+    gl_PointSize = 0.0;
+    v_color = vec4(0.0);
+    return;
+  }
+
+  gl_Position = u_projectionMatrix * u_modelViewMatrix * vec4(position, 1.0);
+  gl_PointSize = u_pointSize * (0.5 + energy) * 4.0 / gl_Position.w;
+
+  float green = a_seed.x / float(PARTICLE_BANDS - 1);
+  v_color = vec4(1.0 - green, green, 0.3 + 0.7 * age / kLifetime, 1.0 - age / kLifetime);
+}
@@ -0,0 +1,13 @@
+#version 100
+
+precision mediump float;
+
+uniform sampler2D u_texture;
+
+varying vec2 v_texCoord;
+
+void main()
+{
+  // Premultiplied alpha, the target was cleared to transparent black
+  gl_FragColor = texture2D(u_texture, v_texCoord);
+}
@@ -0,0 +1,14 @@
+#version 100
+
+precision mediump float;
+
+attribute vec2 a_position;
+
+varying vec2 v_texCoord;
+
+void main()
+{
+  // The quad covers the viewport, the texture spans it exactly
+  v_texCoord = a_position * 0.5 + 0.5;
+  gl_Position = vec4(a_position, 0.0, 1.0);
+}
@@ -1,18 +1,16 @@
-#version 100
+// #version and the variant defines are prepended by CBarShader, see
+// vert.glsl
 
 precision mediump float;
 
-uniform float u_pointSize;
-
 varying vec4 v_color;
 
 void main()
 {
-  if (u_pointSize != 0.0)
-  {
-    vec2 coord = gl_PointCoord - vec2(0.5);  //from [0,1] to [-0.5,0.5]
-    if(length(coord) > 0.5)                  //outside of circle radius?
-      discard;
-  }
+#ifdef POINTS
+  vec2 coord = gl_PointCoord - vec2(0.5);  //from [0,1] to [-0.5,0.5]
+  if(length(coord) > 0.5)                  //outside of circle radius?
+    discard;
+#endif
   gl_FragColor = v_color;
 }
@@ -0,0 +1,12 @@
+#version 100
+
+precision mediump float;
+
+varying vec4 v_color;
+
+void main()
+{
+  // Round particles with a soft edge
+  float radius = length(gl_PointCoord - vec2(0.5));
+  gl_FragColor = vec4(v_color.rgb, v_color.a * (1.0 - smoothstep(0.3, 0.5, radius)));
+}
@@ -1,19 +1,33 @@
-#version 100
+// #version and the variant defines are prepended by CBarShader:
+// POINTS  round points of u_pointSize pixels
 
 precision mediump float;
 
 uniform mat4 u_projectionMatrix;
 uniform mat4 u_modelViewMatrix;
+uniform float u_intensity;
+uniform vec4 u_grid; // bar spacing, bar width, last row
+#ifdef POINTS
 uniform float u_pointSize;
+#endif
 
-attribute vec4 a_position;
+attribute vec4 a_grid; // column, row, corner bits x | y << 1 | z << 2
 attribute vec4 a_color;
+attribute float a_height;
 
 varying vec4 v_color;
 
 void main()
 {
-  gl_Position = u_projectionMatrix * u_modelViewMatrix * a_position;
+  // corner.y is 0 for the bottom and 1 for the top of a bar
+  vec3 corner = mod(floor(a_grid.zzz / vec3(1.0, 2.0, 4.0)), 2.0);
+  vec4 position = vec4(-1.6 + a_grid.x * u_grid.x + corner.x * u_grid.y,
+                       corner.y * a_height,
+                       -1.6 + (u_grid.z - a_grid.y) * u_grid.x + corner.z * u_grid.y,
+                       1.0);
+  gl_Position = u_projectionMatrix * u_modelViewMatrix * position;
+#ifdef POINTS
   gl_PointSize = u_pointSize;
-  v_color = a_color;
+#endif
+  v_color = vec4(a_color.rgb * u_intensity, a_color.a);
 }